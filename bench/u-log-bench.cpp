@@ -0,0 +1,139 @@
+/***
+  u-log-bench.cpp throughput and latency of u::log under different sinks and flags
+  Copyright (C) 2013  Renweu Gao
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ***/
+
+/*
+ * build: g++ -std=c++11 -O2 -I.. u-log-bench.cpp -o u-log-bench -lpthread
+ * usage: u-log-bench [messages per thread] [threads] [log file] > /dev/null
+ *        terminal sinks write to standard output, the report goes to standard error.
+ *        each case runs once with 1 thread and once with [threads] threads and reports
+ *        ns/msg as wall time over all messages, plus percentiles of single calls
+ *        (these include one clock read, about the cost of the "clock" case)
+ */
+
+#include "u-log"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace {
+
+    struct bench_case {
+        const char *_name;
+        std::function<void()> _setup;
+        std::function<void(int, int)> _call; // (thread, message)
+        std::function<void()> _teardown;
+    };
+
+    unsigned long long clock_ns() {
+        return u::ws::clock_ns();
+    }
+
+    void run(const bench_case &c, int threads, int messages) {
+        c._setup();
+        std::vector<std::vector<unsigned> > samples(threads, std::vector<unsigned>(messages));
+        std::vector<std::thread> workers;
+        std::atomic<int> ready(0);
+        std::atomic<bool> go(false);
+        unsigned long long start = 0;
+        for (int t = 0; t < threads; ++t) {
+            workers.push_back(std::thread([&, t]() {
+                std::vector<unsigned> &sample = samples[t];
+                ++ready;
+                while (!go.load()) {
+                    std::this_thread::yield();
+                }
+                for (int i = 0; i < messages; ++i) {
+                    unsigned long long before = clock_ns();
+                    c._call(t, i);
+                    sample[i] = static_cast<unsigned> (std::min<unsigned long long> (clock_ns() - before, ~0U));
+                }
+            }));
+        }
+        while (ready.load() < threads) {
+            std::this_thread::yield();
+        }
+        start = clock_ns();
+        go.store(true);
+        for (size_t t = 0; t < workers.size(); ++t) {
+            workers[t].join();
+        }
+        c._teardown();
+        unsigned long long wall = clock_ns() - start;
+
+        std::vector<unsigned> all;
+        all.reserve(static_cast<size_t> (threads) * messages);
+        for (int t = 0; t < threads; ++t) {
+            all.insert(all.end(), samples[t].begin(), samples[t].end());
+        }
+        std::sort(all.begin(), all.end());
+        size_t n = all.size();
+        fprintf(stderr, "%-22s %3d %10.1f %8u %8u %8u %8u %10u\n", c._name, threads,
+                static_cast<double> (wall) / n, all[n * 50 / 100], all[n * 90 / 100],
+                all[n * 99 / 100], all[std::min(n - 1, n * 999 / 1000)], all[n - 1]);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int messages = argc > 1 ? atoi(argv[1]) : 200000;
+    int threads = argc > 2 ? atoi(argv[2]) : 4;
+    std::string file = argc > 3 ? argv[3] : "/tmp/u-log-bench.log";
+    std::string binary = file + ".bin";
+    if (messages <= 0 || threads <= 0) {
+        fprintf(stderr, "usage: %s [messages per thread] [threads] [log file]\n", argv[0]);
+        return 1;
+    }
+
+    const std::ios_base::openmode trunc = std::ofstream::out | std::ofstream::trunc;
+    std::function<void()> nothing = []() {};
+    std::function<void()> flush = []() { u::log::flush(); };
+    std::function<void()> file_open = [&]() { u::log::open(u::F | 0x7F00, 0, ' ', file, trunc); };
+    std::function<void(int, int)> info = [](int t, int i) { u::log::info("thread %d message %d value %f", t, i, i * 0.5); };
+
+    std::vector<bench_case> cases;
+    cases.push_back(bench_case{"clock", nothing, [](int, int) {}, nothing});
+    cases.push_back(bench_case{"info masked", []() { u::log::open(u::T | 0x0200 | 0x1000); }, info, nothing});
+    cases.push_back(bench_case{"u_info masked", []() { u::log::open(u::T | 0x0200 | 0x1000); },
+                               [](int t, int i) { u_info("thread %d message %d value %f", t, i, i * 0.5); }, nothing});
+    cases.push_back(bench_case{"info T", []() { u::log::open(u::T | 0x7F00); }, info, flush});
+    cases.push_back(bench_case{"info T|FLUSH", []() { u::log::open(u::T | u::FLUSH | 0x7F00); }, info, flush});
+    cases.push_back(bench_case{"info F", file_open, info, flush});
+    cases.push_back(bench_case{"info F|FLUSH", [&]() { u::log::open(u::F | u::FLUSH | 0x7F00, 0, ' ', file, trunc); }, info, flush});
+    cases.push_back(bench_case{"info F buffered", [&]() { file_open(); u::log::buffer(64 * 1024); },
+                               info, []() { u::log::flush(); u::log::buffer(0); }});
+    cases.push_back(bench_case{"info F|MMAP", [&]() { u::log::open(u::F | u::MMAP | 0x7F00, 0, ' ', file, trunc); }, info, flush});
+    cases.push_back(bench_case{"info F async", [&]() { file_open(); u::log::async(1 << 16); }, info, []() { u::log::sync(); }});
+    cases.push_back(bench_case{"echo F", file_open, [](int t, int i) { u::log::echo("thread %d message %d\n", t, i); }, flush});
+    cases.push_back(bench_case{"print F", file_open, [](int, int) { u::log::print("a constant line of text\n"); }, flush});
+    cases.push_back(bench_case{"indent F", file_open, [](int t, int i) { u::log::indent(2, -2, "thread %d message %d", t, i); }, flush});
+    cases.push_back(bench_case{"binary", [&]() { u::log::open(u::F | 0x7F00, 0, ' ', file, trunc); u::log_binary::open(binary); },
+                               [](int t, int i) { u_log_binary(0x4000, "thread %d message %d value %f", t, i, i * 0.5); },
+                               []() { u::log_binary::close(); }});
+
+    fprintf(stderr, "%d messages per thread\n", messages);
+    fprintf(stderr, "%-22s %3s %10s %8s %8s %8s %8s %10s\n", "case", "thr", "ns/msg", "p50", "p90", "p99", "p99.9", "max");
+    for (size_t i = 0; i < cases.size(); ++i) {
+        run(cases[i], 1, messages);
+        if (threads > 1) {
+            run(cases[i], threads, messages);
+        }
+    }
+    return 0;
+}
@@ -28,6 +28,12 @@
 #include <map>
 #include <limits>
 #include <memory>
+#include <cstdio>
+#include <cctype>
+#include <cstddef>
+#include <type_traits>
+#include <algorithm>
+#include <functional>
 
 namespace u {
 
@@ -58,6 +64,9 @@ namespace u {
     /*represent for 'Open'*/
     const static unsigned char O = 0x08;
 
+    /*represent for 'Memory mapped' file output*/
+    const static unsigned char MMAP = 0x20;
+
     /*represent for 'Left'*/
     const static unsigned char L = 0x00;
 
@@ -230,35 +239,412 @@ namespace u {
      ***/
     static char * va_format(const char *format, va_list arg) {
         char * ret = NULL;
-        std::unique_ptr<char [] > formatted;
-        int buffer_size = 1024;
-        int needed = 0;
         if (format != NULL) {
-            while (true) {
-                formatted.reset(new char[buffer_size]);
-                needed = vsnprintf(&formatted[0], buffer_size, format, arg);
-                if (needed <= 0 || needed > buffer_size) {
-                    buffer_size += std::abs(needed - buffer_size + 1);
+            va_list copy;
+            va_copy(copy, arg);
+            int needed = vsnprintf(NULL, 0, format, copy);
+            va_end(copy);
+            if (needed >= 0) {
+                ret = new char[needed + 1];
+                vsnprintf(ret, needed + 1, format, arg);
+            }
+        }
+        return ret;
+    }
+
+    /*
+     * format_arg: one argument of the variadic formatter, reduced to the few types printf
+     *             knows how to read. anything else is rejected at compile time
+     */
+    struct format_arg {
+        char _tag; // 'i' signed, 'u' unsigned, 'd' double, 'L' long double, 's' string, 'p' pointer
+        unsigned char _size; // bytes of the original integer, %u %x ... of a negative value print only those (at least an int)
+        union {
+            long long _i;
+            unsigned long long _u;
+            double _d;
+            const char *_s;
+            const void *_p;
+        };
+        long double _L; // kept out of the union, its calling convention differs between GCC versions
+    };
+
+    template <typename T>
+    struct format_rejected : std::false_type {
+    };
+
+    template <typename T>
+    static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, format_arg>::type
+    make_format_arg(const T &value) {
+        format_arg a;
+        a._tag = 'i';
+        a._size = sizeof(T);
+        a._i = value;
+        return a;
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, format_arg>::type
+    make_format_arg(const T &value) {
+        format_arg a;
+        a._tag = 'u';
+        a._size = sizeof(T);
+        a._u = value;
+        return a;
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_enum<T>::value, format_arg>::type
+    make_format_arg(const T &value) {
+        format_arg a;
+        a._tag = 'i';
+        a._size = sizeof(T);
+        a._i = static_cast<long long> (value);
+        return a;
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value, format_arg>::type
+    make_format_arg(const T &value) {
+        format_arg a;
+        if (std::is_same<T, long double>::value) {
+            a._tag = 'L';
+            a._L = value;
+        } else {
+            a._tag = 'd';
+            a._d = value;
+        }
+        return a;
+    }
+
+    template <typename T>
+    static format_arg make_format_arg(T * const &value) {
+        format_arg a;
+        a._tag = 'p';
+        a._p = value;
+        return a;
+    }
+
+    static format_arg make_format_arg(const char * const &value) {
+        format_arg a;
+        a._tag = 's';
+        a._s = value == NULL ? "(null)" : value;
+        return a;
+    }
+
+    static format_arg make_format_arg(char * const &value) {
+        return make_format_arg(static_cast<const char *> (value));
+    }
+
+    template <size_t N>
+    static format_arg make_format_arg(const char (&value)[N]) {
+        return make_format_arg(static_cast<const char *> (value));
+    }
+
+    template <size_t N>
+    static format_arg make_format_arg(char (&value)[N]) {
+        return make_format_arg(static_cast<const char *> (value));
+    }
+
+    static format_arg make_format_arg(const std::string &value) {
+        return make_format_arg(value.c_str());
+    }
+
+    static format_arg make_format_arg(const std::nullptr_t &) {
+        format_arg a;
+        a._tag = 'p';
+        a._p = NULL;
+        return a;
+    }
+
+    template <typename T>
+    static typename std::enable_if<!std::is_arithmetic<T>::value && !std::is_enum<T>::value && !std::is_array<T>::value, format_arg>::type
+    make_format_arg(const T &) {
+        static_assert(format_rejected<T>::value, "u::format: argument type cannot be formatted");
+        return format_arg();
+    }
+
+    /*append @count chars of @text to @buffer of @size bytes holding @length chars so far*/
+    static void format_copy(char *buffer, size_t size, size_t &length, const char *text, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            if (length + 1 < size) {
+                buffer[length] = text[i];
+            }
+            ++length;
+        }
+    }
+
+    /*
+     * @function vformat_to: printf-like formatting of @args into @buffer (@size bytes, always
+     *                       null terminated when @size > 0). a conversion is applied to the
+     *                       argument as it really is: integers keep their own width (hh and h
+     *                       may only narrow them) and %s prints any argument. an argument
+     *                       the conversion does not fit (a string or pointer given to %d, an
+     *                       integer given to %f, a double given to %x...) prints "<bad arg>",
+     *                       a missing one "<missing arg>". %n is not supported. a specification
+     *                       too long for the internal buffer is copied as it is and its argument
+     *                       skipped
+     * @return length of the full result, like snprintf
+     */
+    static int vformat_to(char *buffer, size_t size, const char *format, const format_arg *args, size_t count) {
+        size_t length = 0;
+        size_t next = 0;
+        char spec[32];
+        if (format == NULL) {
+            format = "";
+        }
+        while (*format != '\0') {
+            const char *start = format;
+            if (*format != '%' || format[1] == '%') {
+                format_copy(buffer, size, length, format, 1);
+                format += (*format == '%' ? 2 : 1);
+                continue;
+            }
+            /*room for the flags, width and precision, the rest is kept for 'l' 'l' conversion '\0'*/
+            const size_t limit = sizeof(spec) - 4;
+            bool fits = true;
+            size_t n = 0;
+            spec[n++] = *format++;
+            while (*format != '\0' && strchr("-+ #0", *format) != NULL) {
+                if (n < limit) {
+                    spec[n++] = *format;
                 } else {
-                    break;
+                    fits = false;
                 }
+                ++format;
             }
-            if (needed < buffer_size) {
-                ret = new char[needed + 1];
-                memcpy(ret, formatted.get(), needed + 1);
-                formatted.release();
+            for (int part = 0; part < 2; ++part) {
+                if (part == 1) {
+                    if (*format != '.') {
+                        break;
+                    }
+                    if (n < limit) {
+                        spec[n++] = *format;
+                    } else {
+                        fits = false;
+                    }
+                    ++format;
+                }
+                if (*format == '*') {
+                    ++format;
+                    long long value = 0;
+                    if (next < count) {
+                        value = (args[next]._tag == 'i' || args[next]._tag == 'u') ? args[next]._i : 0;
+                        ++next;
+                    }
+                    int written = (n < limit) ? snprintf(spec + n, limit - n, "%d", static_cast<int> (value)) : -1;
+                    if (written < 0 || static_cast<size_t> (written) >= limit - n) {
+                        fits = false;
+                    } else {
+                        n += written;
+                    }
+                } else {
+                    while (isdigit(static_cast<unsigned char> (*format))) {
+                        if (n < limit) {
+                            spec[n++] = *format;
+                        } else {
+                            fits = false;
+                        }
+                        ++format;
+                    }
+                }
+            }
+            size_t narrow = 0; // bytes asked by hh or h, 0 for none
+            while (*format != '\0' && strchr("hlLqjzt", *format) != NULL) {
+                if (*format == 'h') {
+                    narrow = (narrow == 0) ? sizeof(short) : sizeof(char);
+                }
+                ++format;
+            }
+            char conversion = *format;
+            if (conversion != '\0' && !fits) {
+                /*too long to be handed to snprintf: copied as it is, the argument is skipped*/
+                if (conversion != 'n' && strchr("diouxXeEfFgGaAcsp", conversion) != NULL && next < count) {
+                    ++next;
+                }
+                conversion = '!';
+            }
+            if (conversion == '\0' || strchr("diouxXeEfFgGaAcspn", conversion) == NULL) {
+                /*not a conversion, copied as it is*/
+                size_t raw = (conversion == '\0') ? strlen(start) : static_cast<size_t> (format - start + 1);
+                format_copy(buffer, size, length, start, raw);
+                format = start + raw;
+                continue;
+            }
+            ++format;
+            if (conversion == 'n') {
+                continue;
+            }
+            if (next >= count) {
+                format_copy(buffer, size, length, "<missing arg>", 13);
+                continue;
+            }
+            const format_arg &a = args[next++];
+            const char *fits_arg = (a._tag == 's' || a._tag == 'p') ? "sp" : (a._tag == 'd' || a._tag == 'L') ? "eEfFgGaAs" : "diouxXcs";
+            if (strchr(fits_arg, conversion) == NULL) {
+                format_copy(buffer, size, length, "<bad arg>", 9);
+                continue;
+            }
+            char *out = (length < size) ? buffer + length : NULL;
+            size_t room = (length < size) ? size - length : 0;
+            bool floating = (strchr("eEfFgGaA", conversion) != NULL);
+            int written = 0;
+            if (a._tag == 's') {
+                if (conversion == 'p') {
+                    spec[n++] = 'p';
+                    spec[n] = '\0';
+                    written = snprintf(out, room, spec, static_cast<const void *> (a._s));
+                } else {
+                    spec[n++] = 's';
+                    spec[n] = '\0';
+                    written = snprintf(out, room, spec, a._s);
+                }
+            } else if (a._tag == 'p') {
+                spec[n++] = 'p';
+                spec[n] = '\0';
+                written = snprintf(out, room, spec, a._p);
+            } else if (a._tag == 'd' || a._tag == 'L') {
+                if (!floating) {
+                    conversion = 'g';
+                }
+                if (a._tag == 'L') {
+                    spec[n++] = 'L';
+                }
+                spec[n++] = conversion;
+                spec[n] = '\0';
+                if (a._tag == 'L') {
+                    written = snprintf(out, room, spec, a._L);
+                } else {
+                    written = snprintf(out, room, spec, a._d);
+                }
+            } else {
+                long long value = a._i;
+                if (conversion == 'c') {
+                    spec[n++] = 'c';
+                    spec[n] = '\0';
+                    written = snprintf(out, room, spec, static_cast<int> (value));
+                } else {
+                    size_t bytes = std::max<size_t> (a._size, sizeof(int));
+                    bool narrowed = (narrow != 0 && narrow < bytes);
+                    if (narrowed) {
+                        bytes = narrow;
+                    }
+                    if (conversion == 's') {
+                        conversion = (a._tag == 'i') ? 'd' : 'u';
+                    } else if ((conversion == 'd' || conversion == 'i') && a._tag == 'u' && !narrowed) {
+                        conversion = 'u';
+                    }
+                    if (bytes < sizeof(long long)) {
+                        /*printed at the width of the argument, as printf would after promotion*/
+                        unsigned long long mask = (1ULL << (8 * bytes)) - 1;
+                        unsigned long long bits = static_cast<unsigned long long> (value) & mask;
+                        if ((conversion == 'd' || conversion == 'i') && (bits >> (8 * bytes - 1)) != 0) {
+                            bits |= ~mask;
+                        }
+                        value = static_cast<long long> (bits);
+                    }
+                    spec[n++] = 'l';
+                    spec[n++] = 'l';
+                    spec[n++] = conversion;
+                    spec[n] = '\0';
+                    written = snprintf(out, room, spec, value);
+                }
+            }
+            if (written > 0) {
+                length += written;
+            }
+        }
+        if (size > 0) {
+            buffer[length < size ? length : size - 1] = '\0';
+        }
+        return static_cast<int> (length);
+    }
+
+    /*
+     * @function format_to: type-safe snprintf, see vformat_to
+     * @params
+     *   @buffer @size storage supplied by the caller
+     * @return length of the full result, the output is cut when it is not less than @size
+     */
+    template <typename ...Args>
+    static int format_to(char *buffer, size_t size, const char *format, const Args &... args) {
+        const format_arg list[sizeof...(Args) + 1] = {make_format_arg(args)..., format_arg()};
+        return vformat_to(buffer, size, format, list, sizeof...(Args));
+    }
+
+    /*
+     * @function format_local: type-safe formatting into a buffer owned by the calling thread.
+     *                         an earlier result may be an argument (u::log formats with it
+     *                         too), it is then formatted aside and copied in
+     * @return the result, valid until the next call of format_local on this thread
+     */
+    template <typename ...Args>
+    static const char * format_local(const char *format, const Args &... args) {
+        static thread_local char local[1024];
+        static thread_local std::unique_ptr<char []> large;
+        static thread_local size_t large_size = 0;
+        const format_arg list[sizeof...(Args) + 1] = {make_format_arg(args)..., format_arg()};
+        std::less<const char *> before;
+        for (size_t i = 0; i < sizeof...(Args); ++i) {
+            const char *text = list[i]._s;
+            if (list[i]._tag == 's' && ((!before(text, local) && before(text, local + sizeof(local))) ||
+                                        (large && !before(text, large.get()) && before(text, large.get() + large_size)))) {
+                int needed = vformat_to(NULL, 0, format, list, sizeof...(Args));
+                std::unique_ptr<char []> aside(new char[needed + 1]);
+                vformat_to(aside.get(), needed + 1, format, list, sizeof...(Args));
+                return format_local("%s", aside.get());
+            }
+        }
+        int needed = vformat_to(local, sizeof(local), format, list, sizeof...(Args));
+        if (needed < static_cast<int> (sizeof(local))) {
+            return local;
+        }
+        if (large_size < static_cast<size_t> (needed) + 1) {
+            large_size = needed + 1;
+            large.reset(new char[large_size]);
+        }
+        vformat_to(large.get(), large_size, format, list, sizeof...(Args));
+        return large.get();
+    }
+
+    /*
+     * @function format: type-safe formatting into a new string, release it with
+     *                   u::string::free (or delete [])
+     */
+    template <typename ...Args>
+    static char * format(const char *format, const Args &... args) {
+        char * ret = NULL;
+        if (format != NULL) {
+            char local[256];
+            int needed = format_to(local, sizeof(local), format, args...);
+            ret = new char[needed + 1];
+            if (needed < static_cast<int> (sizeof(local))) {
+                memcpy(ret, local, needed + 1);
+            } else {
+                format_to(ret, needed + 1, format, args...);
             }
         }
         return ret;
     }
 
-    static char * format(const char *format, ...) {
+    /*
+     * @function format: type-safe formatting into memory of @alloc, an allocator of char
+     *                   such as u::ws::arena_allocator<char>. release the result's
+     *                   strlen + 1 chars to @alloc
+     */
+    template <typename Allocator, typename ...Args>
+    static typename std::enable_if<std::is_same<typename Allocator::value_type, char>::value, char *>::type
+    format(Allocator alloc, const char *format, const Args &... args) {
         char * ret = NULL;
         if (format != NULL) {
-            va_list arg_list;
-            va_start(arg_list, format);
-            ret = u::va_format(format, arg_list);
-            va_end(arg_list);
+            char local[256];
+            int needed = format_to(local, sizeof(local), format, args...);
+            ret = std::allocator_traits<Allocator>::allocate(alloc, needed + 1);
+            if (needed < static_cast<int> (sizeof(local))) {
+                memcpy(ret, local, needed + 1);
+            } else {
+                format_to(ret, needed + 1, format, args...);
+            }
         }
         return ret;
     }
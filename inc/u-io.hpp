@@ -89,6 +89,50 @@ namespace u {
       return ret;
     }
 
+    /*
+     *@function streamrec: read records of @in line by line, parse them with @reader
+     *                     (as loadrec does), map them with @transform and write the results
+     *                     with @writer (as saverec does) to @out, in input order. records are
+     *                     streamed through a u::ws::pipeline on @ws, so memory stays constant
+     *@params
+     *  @parallel parse and transform tasks running at the same time, 0 for one per worker
+     *@return true if both files could be opened
+    **/
+    template <typename T, class data_reader, class data_transform, class data_writer>
+    static bool streamrec(u::ws::work_station &ws, const std::string &in, const std::string &out, data_reader reader, data_transform transform, data_writer writer, size_t parallel = 0) {
+      bool ret = false;
+      std::ifstream ifs(in.c_str());
+      std::ofstream ofs(out.c_str());
+      if (!ifs.fail() && !ofs.fail()) {
+        typedef std::pair<bool, T> parsed;
+        typedef typename std::decay<decltype(transform(std::declval<T&>()))>::type U;
+        u::ws::pipeline<std::string>(ws, [&ifs](std::string &line) {
+          bool more = false;
+          while (!more && std::getline(ifs, line)) {
+            u::string::trim(&line[0], '\r', u::S);
+            line.resize(strlen(line.c_str()));
+            more = !line.empty();
+          }
+          return more;
+        }).then([reader](std::string &line) mutable {
+          parsed data;
+          data.first = reader(data.second, line);
+          return data;
+        }, parallel).filter([](parsed &data) {
+          return data.first;
+        }).then([transform](parsed &data) mutable {
+          return transform(data.second);
+        }, parallel).sink([&ofs, writer](U &data) mutable {
+          writer(data, ofs);
+          ofs << '\n';
+        });
+        ret = true;
+      }
+      ifs.close();
+      ofs.close();
+      return ret;
+    }
+
     template <typename T>
     class default_data_writer
     {
@@ -24,24 +24,445 @@
 #include "u-string.hpp"
 #include "u-path.hpp"
 #include "u-timer.hpp"
+#include "u-thread.hpp"
 #include <cassert>
 #include <fstream>
 #include <string>
 #include <cstdarg>
 #include <cmath>
 #include <vector>
+#include <sstream>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <csignal>
+#include <pthread.h>
+#include <new>
+
+/*
+ * U_LOG_STRIP: levels removed at compile time, built from the level bits of @_flag
+ *              (debug 0x8000, info 0x4000, warning 0x2000, error 0x1000, fatal 0x0800).
+ *              e.g. -DU_LOG_STRIP=0xC000 drops every debug and info statement
+ */
+#ifndef U_LOG_STRIP
+#define U_LOG_STRIP 0x0000
+#endif
 
 namespace u {
 
+    /*
+     * log_backend: state of the asynchronous mode of u::log. callers enqueue finished
+     *              messages into a preallocated ring, one background thread writes them
+     *              to the sinks in batches and flushes once per batch. the writer sleeps
+     *              for @_period between batches, callers only wake it once the ring fills
+     *              up to @_high, flush() and sync() wake it at once
+     */
+    struct log_backend {
+        /*what a caller does when the ring is full*/
+        enum overflow {
+            block, // wait for the writer to make room
+            drop,  // discard the message
+            count  // discard the message, the writer reports how many were lost
+        };
+
+        struct record {
+            std::string _text;
+            unsigned short _flag;
+        };
+
+        u::ws::mpmc_queue<record> _ring;
+        overflow _policy;
+        std::atomic<bool> _stop;
+        std::atomic<bool> _sleeping;
+        std::atomic<int> _flushing;              // callers of flush() waiting for the writer
+        std::atomic<int> _crashing;              // 1 once the crash handler wants the sinks, 2 when the writer let go
+        size_t _high;                            // ring depth that wakes the writer
+        std::chrono::milliseconds _period;       // longest sleep of the writer between batches
+        std::atomic<unsigned long long> _queued;
+        std::atomic<unsigned long long> _written;
+        std::atomic<unsigned long long> _dropped;
+        unsigned long long _reported;
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        std::condition_variable _idle;
+        std::thread _thread;
+
+        log_backend(size_t capacity, overflow policy) : _ring(capacity), _policy(policy), _stop(false), _sleeping(false),
+                                                        _flushing(0), _crashing(0), _high(_ring.capacity() / 4), _period(5),
+                                                        _queued(0), _written(0), _dropped(0), _reported(0) {
+        }
+
+        /*whether the writer has a reason to run before its period is over*/
+        bool urgent() const {
+            return _stop.load() || _crashing.load() != 0 || _ring.size() >= _high || (_flushing.load() != 0 && !_ring.empty());
+        }
+
+        void wake() {
+            if (_sleeping.load()) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _cv.notify_one();
+            }
+        }
+    };
+
+    /*
+     * log_rotation: state of file rotation. a background thread keeps "<file>.next" opened
+     *               and preallocated, and raises @_due once the file is too old. the writer
+     *               counts the bytes it sends to the file and raises @_due itself as soon
+     *               as they reach @_size. the thread writing the log then swaps the prepared
+     *               stream into place, which costs no I/O, and leaves renames and closing
+     *               to the background thread
+     */
+    struct log_rotation {
+        size_t _size;                            // rotate beyond this many bytes, 0 for never
+        std::chrono::seconds _interval;          // rotate files older than this, 0 for never
+        int _keep;                               // rotated files kept as <file>.1 ... <file>.keep
+        size_t _preallocate;                     // bytes reserved for the next file
+        std::string _base;
+        unsigned long long _written;             // bytes in the active file, under the sink mutex
+        std::atomic<std::ofstream*> _next;       // prepared stream, taken by the writer under @_mutex
+        std::atomic<std::ofstream*> _retired;    // stream swapped out by the writer under @_mutex
+        std::atomic<bool> _due;
+        std::atomic<unsigned long long> _rotated;
+        std::atomic<bool> _stop;
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        std::thread _thread;
+
+        log_rotation(const std::string &base, size_t size, std::chrono::seconds interval, int keep, size_t preallocate) :
+            _size(size), _interval(interval), _keep(keep), _preallocate(preallocate), _base(base), _written(0),
+            _next(nullptr), _retired(nullptr), _due(false), _rotated(0), _stop(false) {
+            struct stat st;
+            if (::stat(_base.c_str(), &st) == 0) {
+                _written = static_cast<unsigned long long> (st.st_size);
+            }
+        }
+
+        /*account @bytes written to the active file, @_due is raised once @_size is reached*/
+        void count(size_t bytes) {
+            _written += bytes;
+            if (_size > 0 && _written >= _size && !_due.load(std::memory_order_relaxed)) {
+                _due.store(true, std::memory_order_release);
+            }
+        }
+
+        /*open "<file>.next" with @_preallocate bytes reserved beyond its end*/
+        std::ofstream *prepare() {
+            std::string path(_base + ".next");
+            int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                return nullptr;
+            }
+#ifdef FALLOC_FL_KEEP_SIZE
+            if (_preallocate > 0) {
+                ::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t> (_preallocate));
+            }
+#endif
+            ::close(fd);
+            std::ofstream *ofs = new std::ofstream(path.c_str(), std::ofstream::out | std::ofstream::app);
+            if (!ofs->is_open()) {
+                delete ofs;
+                ofs = nullptr;
+            }
+            return ofs;
+        }
+
+        /*shift <file>.i to <file>.i+1, the active file becomes <file>.1 and .next the active one*/
+        void shift() {
+            for (int i = _keep; i >= 1; --i) {
+                std::string from(i == 1 ? _base : _base + "." + std::to_string(i - 1));
+                std::string to(_base + "." + std::to_string(i));
+                if (i == _keep) {
+                    ::unlink(to.c_str());
+                }
+                ::rename(from.c_str(), to.c_str());
+            }
+            if (_keep < 1) {
+                ::unlink(_base.c_str());
+            }
+            ::rename((_base + ".next").c_str(), _base.c_str());
+        }
+
+        /*give the blocks preallocated beyond the end of @path back*/
+        static void trim(const std::string &path) {
+            struct stat st;
+            if (::stat(path.c_str(), &st) == 0) {
+                if (::truncate(path.c_str(), st.st_size) != 0) {
+                    return;
+                }
+            }
+        }
+
+        void run() {
+            std::chrono::steady_clock::time_point opened = std::chrono::steady_clock::now();
+            std::chrono::milliseconds tick(1000);
+            if (_interval.count() > 0 && _interval < tick) {
+                tick = _interval;
+            }
+            std::ofstream *closing = nullptr;
+            std::string closing_path;
+            while (!_stop.load()) {
+                if (closing != nullptr) {
+                    /*swapped out a tick ago, no writer still holds it*/
+                    closing->close();
+                    delete closing;
+                    closing = nullptr;
+                    trim(closing_path);
+                }
+                std::ofstream *retired = _retired.exchange(nullptr);
+                if (retired != nullptr) {
+                    shift();
+                    _rotated.fetch_add(1);
+                    opened = std::chrono::steady_clock::now();
+                    closing = retired;
+                    closing_path = (_keep >= 1) ? _base + ".1" : std::string();
+                }
+                std::unique_lock<std::mutex> lock(_mutex);
+                /*
+                 * a stream swapped in since the exchange above is the live file, still named
+                 * "<file>.next" until it is shifted: nothing is prepared over it. the writer
+                 * swaps under @_mutex, so the check and prepare() cannot be overtaken
+                 */
+                if (_next.load() == nullptr && _retired.load() == nullptr) {
+                    _next.store(prepare());
+                }
+                if (!_due.load() && retired == nullptr && _interval.count() > 0 &&
+                    std::chrono::steady_clock::now() - opened >= _interval) {
+                    _due.store(true, std::memory_order_release);
+                }
+                if (!_stop.load() && _retired.load() == nullptr) {
+                    _cv.wait_for(lock, tick);
+                }
+            }
+            if (closing != nullptr) {
+                closing->close();
+                delete closing;
+                trim(closing_path);
+            }
+        }
+    };
+
+    /*
+     * log_mapped: file sink writing through a shared memory map of the log file. the
+     *             file is extended and preallocated @_chunk bytes at a time, a record is
+     *             copied to the map and @_offset advanced; close() cuts the file back to
+     *             @_offset. until then the last @trailer bytes of the file hold a magic
+     *             word and @_offset, so the text a killed process leaves is found again.
+     *             records must come from one writer at a time, which u::log guarantees
+     *             (sink mutex, or the async drain thread)
+     */
+    struct log_mapped {
+        int _fd;
+        size_t _chunk;
+        char *_map;
+        size_t _map_start;
+        size_t _map_size;
+        std::atomic<size_t> _offset;
+
+        log_mapped(int fd, size_t chunk, size_t offset) : _fd(fd), _chunk(chunk), _map(nullptr), _map_start(0), _map_size(0), _offset(offset) {
+        }
+
+        static const size_t trailer = 16;
+
+        static const char *magic() {
+            return "u::log\x01\x00";
+        }
+
+        /*
+         * @function used: length of the text in @fd of @size bytes, as recorded in the trailer
+         *                 of a file whose writer never reached close(); @size if there is none
+         */
+        static size_t used(int fd, size_t size) {
+            char tail[trailer];
+            if (size < trailer || ::pread(fd, tail, trailer, static_cast<off_t> (size - trailer)) != static_cast<ssize_t> (trailer) ||
+                memcmp(tail, magic(), 8) != 0) {
+                return size;
+            }
+            uint64_t committed = 0;
+            memcpy(&committed, tail + 8, sizeof(committed));
+            return committed <= size - trailer ? static_cast<size_t> (committed) : size;
+        }
+
+        /*record @_offset in the trailer at the end of the map, which is the end of the file*/
+        void commit() {
+            uint64_t committed = _offset.load(std::memory_order_relaxed);
+            memcpy(_map + _map_size - trailer + 8, &committed, sizeof(committed));
+        }
+
+        /*
+         * @function open: map @path, appending to what it holds unless @truncate
+         * @return nullptr if the file cannot be opened
+         */
+        static log_mapped *open(const char *path, bool truncate, size_t chunk = 16 << 20) {
+            int fd = ::open(path, O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+            if (fd < 0) {
+                return nullptr;
+            }
+            struct stat st;
+            size_t size = (::fstat(fd, &st) == 0) ? static_cast<size_t> (st.st_size) : 0;
+            size_t end = used(fd, size);
+            if (end < size && ::ftruncate(fd, static_cast<off_t> (end)) == 0) {
+                size = end; // append right after the text of the previous run
+            }
+            size_t page = static_cast<size_t> (::sysconf(_SC_PAGESIZE));
+            chunk = std::max(2 * page, (chunk + page - 1) / page * page); // room for the trailer after any offset
+            return new log_mapped(fd, chunk, size);
+        }
+
+        /*map the chunk holding byte @at, growing the file as needed*/
+        bool remap(size_t at) {
+            if (_map != nullptr) {
+                ::munmap(_map, _map_size);
+                _map = nullptr;
+            }
+            size_t page = static_cast<size_t> (::sysconf(_SC_PAGESIZE));
+            size_t start = at / page * page;
+            size_t end = start + _chunk;
+            struct stat st;
+            if (::fstat(_fd, &st) != 0) {
+                return false;
+            }
+            if (static_cast<size_t> (st.st_size) < end) {
+                if (::ftruncate(_fd, static_cast<off_t> (end)) != 0) {
+                    return false;
+                }
+#ifdef __linux__
+                ::fallocate(_fd, 0, static_cast<off_t> (start), static_cast<off_t> (_chunk));
+#endif
+            }
+            void *map = ::mmap(nullptr, _chunk, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, static_cast<off_t> (start));
+            if (map == MAP_FAILED) {
+                return false;
+            }
+            _map = static_cast<char*> (map);
+            _map_start = start;
+            _map_size = _chunk;
+            memcpy(_map + _map_size - trailer, magic(), 8);
+            commit();
+            return true;
+        }
+
+        bool append(const char *data, size_t size) {
+            while (size > 0) {
+                size_t at = _offset.load(std::memory_order_relaxed);
+                if (_map == nullptr || at < _map_start || at >= _map_start + _map_size - trailer) {
+                    if (!remap(at)) {
+                        return false;
+                    }
+                }
+                size_t n = std::min(size, _map_start + _map_size - trailer - at);
+                memcpy(_map + (at - _map_start), data, n);
+                _offset.store(at + n, std::memory_order_release);
+                commit();
+                data += n;
+                size -= n;
+            }
+            return true;
+        }
+
+        /*
+         * @function close: unmap and cut the file at the last byte written, trailer included
+         */
+        void close() {
+            if (_map != nullptr) {
+                ::munmap(_map, _map_size);
+                _map = nullptr;
+            }
+            if (_fd >= 0) {
+                if (::ftruncate(_fd, static_cast<off_t> (_offset.load())) != 0) {
+                    /*file keeps its zero filled tail*/
+                }
+                ::close(_fd);
+                _fd = -1;
+            }
+        }
+    };
+
+    /*
+     * log_limit: state of one rate limited or sampled call site, see u_log_sample and
+     *            u_log_rate. a rejected message costs a relaxed atomic operation (plus a
+     *            clock read for rate limits), never a lock
+     */
+    struct log_limit {
+        std::atomic<unsigned long long> _seen;
+        std::atomic<unsigned long long> _suppressed;
+        std::atomic<long long> _tat; // theoretical arrival time of the next message (ns)
+
+        constexpr log_limit() : _seen(0), _suppressed(0), _tat(0) {
+        }
+
+        /*
+         * @function sample: let one message out of every @n through
+         */
+        bool sample(unsigned long long n) {
+            return n <= 1 || _seen.fetch_add(1, std::memory_order_relaxed) % n == 0;
+        }
+
+        /*
+         * @function rate: token bucket refilled with @per_second messages per second and
+         *                 holding at most @burst of them (generic cell rate algorithm).
+         *                 @per_second must be positive, nothing passes otherwise
+         */
+        bool rate(double per_second, unsigned burst = 1) {
+            assert(per_second > 0);
+            if (!(per_second > 0)) {
+                _suppressed.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            long long now = std::chrono::duration_cast<std::chrono::nanoseconds>
+                (std::chrono::steady_clock::now().time_since_epoch()).count();
+            long long interval = static_cast<long long> (1e9 / per_second);
+            long long tolerance = interval * static_cast<long long> (burst > 0 ? burst - 1 : 0);
+            long long tat = _tat.load(std::memory_order_relaxed);
+            while (true) {
+                long long base = tat > now ? tat : now;
+                if (base - now > tolerance) {
+                    _suppressed.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                if (_tat.compare_exchange_weak(tat, base + interval, std::memory_order_relaxed)) {
+                    return true;
+                }
+            }
+        }
+
+        /*
+         * @function suppressed: messages rejected since the last call
+         */
+        unsigned long long suppressed() {
+            if (_suppressed.load(std::memory_order_relaxed) == 0) {
+                return 0;
+            }
+            return _suppressed.exchange(0, std::memory_order_relaxed);
+        }
+    };
+
     template <typename static_members>
     struct log_static_holder
     {
         static unsigned short _flag;
         static char * _filename;
         static std::ofstream _ofs;
+        static char _pending[64 * 1024];           // file output not handed to @_ofs yet
+        static std::atomic<size_t> _pending_size;  // bytes used in @_pending, read by the crash handler
         static char * _prompt;
         static int _indent;
+        static std::atomic<unsigned> _indent_generation; // bumped by open(), threads then reload @_indent
         static char _fill;
+        static log_backend * _backend;
+        static int _precision;
+        static log_rotation * _rotation;
+        static size_t _stage_size;
+        static std::mutex _sink_mutex;
+        static log_mapped * _mapped;
+        static void (* _crash_hook)(int);
     };
 
     template<typename static_members>
@@ -53,15 +474,45 @@ namespace u {
     template<typename static_members>
     std::ofstream log_static_holder<static_members>::_ofs;
 
+    template<typename static_members>
+    char log_static_holder<static_members>::_pending[64 * 1024];
+
+    template<typename static_members>
+    std::atomic<size_t> log_static_holder<static_members>::_pending_size;
+
     template<typename static_members>
     char * log_static_holder<static_members>::_prompt;
 
     template<typename static_members>
     int log_static_holder<static_members>::_indent;
 
+    template<typename static_members>
+    std::atomic<unsigned> log_static_holder<static_members>::_indent_generation;
+
     template<typename static_members>
     char log_static_holder<static_members>::_fill;
 
+    template<typename static_members>
+    log_backend * log_static_holder<static_members>::_backend;
+
+    template<typename static_members>
+    int log_static_holder<static_members>::_precision;
+
+    template<typename static_members>
+    log_rotation * log_static_holder<static_members>::_rotation;
+
+    template<typename static_members>
+    size_t log_static_holder<static_members>::_stage_size;
+
+    template<typename static_members>
+    std::mutex log_static_holder<static_members>::_sink_mutex;
+
+    template<typename static_members>
+    log_mapped * log_static_holder<static_members>::_mapped;
+
+    template<typename static_members>
+    void (* log_static_holder<static_members>::_crash_hook)(int);
+
     class log : public log_static_holder<void> {
     private:
         static bool masked(unsigned short flag) {
@@ -87,170 +538,616 @@ namespace u {
         log() {
         };
 
-    public:
-
         /*
-         * @function open: open log system for logging
-         * @params
-         *   @flag for controlling whether log or not, the meaning of each bit is
-         *         explained as follow:
-         *                    |-- FLUSH flag: enable flush stream after each printing
-         * _flag: 00000000 00000000
-         *        |-------     ||||_ Default flag
-         *        |||||||      |||__ File flag: logging to file @_filename instead of terminal
-         *        |||||||      ||___ Term flag: print message to terminal
-         *        |||||||      |____ Log open flag: record whether log system is opened or not
-         *        |||||||- Print flag: print level flag, that is, message will be printed only if corresponding bit is set
-         *        ||||||- Model flag, if set, print flag compared by bit, else by relation
-         *        |||||- Fatal flag
-         *        ||||- Error flag
-         *        |||- Warning flag
-         *        ||- Info flag
-         *        |- Debug flag
-         *   For example, if we want to debug, then set the most left bit to be 1.
-         *   @indent for printing @indent @fill before printing message
-         *           for example, if @indent = 4, and @fill = '*', it prints "***hello world" instead of "hello world".
-         *   @fill see @indent
-         *   @filename filename to logging message if @flag File bit is set
-         *   @mode mode to open @filename
+         * @function write: send @msg to the sinks selected by @flag (or @_flag when @flag
+         *                  has its D bit set). @flush allows the FLUSH bit to take effect
          */
-        static bool open(unsigned short flag = (u::D | 0x7F00), int indent = 0, char fill = ' ', const std::string &filename = std::string(), std::ios_base::openmode mode = std::ofstream::out | std::ofstream::app) {
-            init();
-            bool ret = true;
+        template <typename T>
+        static void write(const T &msg, unsigned short flag, bool flush) {
+            if (_rotation != nullptr && _rotation->_due.load(std::memory_order_acquire)) {
+                swap();
+            }
             if ((flag & u::D) == u::D) {
-                _flag = ((u::T | u::FLUSH) | (flag & 0xFF00));
-            } else {
-                _flag = flag;
-                if ((flag & (u::F | u::T)) == (u::F | u::T) || (flag & u::F) == u::F) {
-                    if (filename.empty()) {
-                        ret = false;
-                    } else {
-                        _filename = u::string::dup(filename);
-                        _ofs.open(_filename, mode);
+                if ((_flag & (u::F | u::T)) == (u::F | u::T)) {
+                    file(msg);
+                    std::cout << msg;
+                    if ((_flag & u::FLUSH) == u::FLUSH && flush)
+                        std::cout << std::flush;
+                } else if ((_flag & u::F) == u::F && file_open()) {
+                    file(msg);
+                    if ((_flag & u::FLUSH) == u::FLUSH && flush) {
+                       file_flush();
+                    }
+                } else if ((_flag & u::T) == u::T) {
+                    std::cout << msg;
+                    if ((_flag & u::FLUSH) == u::FLUSH && flush) {
+                        std::cout << std::flush;
                     }
                 }
+            } else if ((flag & (u::F | u::T)) == (u::T | u::F)) {
+                if (file_open())
+                    file(msg);
+                std::cout << msg;
+                if ((flag & u::FLUSH) == u::FLUSH && flush)
+                    std::cout << std::flush;
+            } else if ((flag & u::F) == u::F && file_open()) {
+                file(msg);
+            } else if ((flag & u::T) == u::T) {
+                std::cout << msg;
+                if ((flag & u::FLUSH) == u::FLUSH && flush)
+                    std::cout << std::flush;
             }
-            if (ret) {
-                _flag |= u::O;
-            }
-            _indent = indent;
-            _fill = fill;
-            return ret;
         }
 
-        /*
-         * @function reopen: reopen log system. It only changes open bit of @_flag
-         */
-        static void reopen() {
-            if (! opened()) {
-                _flag |= u::O;
-            }
+        static bool file_open() {
+            return _mapped != nullptr || _ofs.is_open();
         }
 
         /*
-         * @function close: set open bit to 0 in @_flag
+         * @function file: append @msg to the file sink, the memory map if there is one.
+         *                 stream output is gathered in @_pending, which the crash handler
+         *                 can read without a lock, rather than in the buffer of @_ofs
          */
-        static void close() {
-            if (opened()) {
-                _flag &= 0xF7;
-            }
+        template <typename T>
+        static void file(const T &msg) {
+            file(text(msg));
         }
 
-        static void set_mode(const unsigned short flag) {
-            if (opened()) {
-                _flag &= 0xFDFF;
-                _flag |= (flag & 0x0200);
+        static void file(const std::string &msg) {
+            file(msg.data(), msg.size());
+        }
+
+        static void file(const char *msg) {
+            if (msg != nullptr) {
+                file(msg, strlen(msg));
             }
         }
 
-        static void toggle_mode() {
-            if (opened()) {
-                if ((_flag & 0x0200) == 0x0200) {
-                    _flag &= 0xFDFF;
+        static void file(const char *data, size_t size) {
+            if (_mapped != nullptr) {
+                _mapped->append(data, size);
+            } else {
+                size_t used = _pending_size.load(std::memory_order_relaxed);
+                if (used + size > sizeof(_pending)) {
+                    file_flush();
+                    used = 0;
+                }
+                if (size >= sizeof(_pending)) {
+                    if (_ofs.is_open()) {
+                        _ofs.write(data, static_cast<std::streamsize> (size));
+                    }
                 } else {
-                    _flag |= 0x0200;
+                    memcpy(_pending + used, data, size);
+                    _pending_size.store(used + size, std::memory_order_release);
+                }
+                if (_rotation != nullptr) {
+                    _rotation->count(size);
                 }
             }
         }
 
         /*
-         * @function term: print message to terminal no matter log system is opened or not.
-         * @params
-         *   @bspace print @bspace (>0) + @_indent @_fill before printing message
-         *   @aspace adjust @_indent when @aspace less than 0 (used for restore state)
-         *   @format formatted message to print
+         * @function file_flush: hand @_pending to @_ofs and flush it, @_sink_mutex held
          */
-        static std::ostream &term(int bspace, int aspace, const char* format, ...) {
-            if (format != nullptr) {
-                char * msg = nullptr;
-                va_list arg_list;
-                va_start(arg_list, format);
-                msg = va_format(format, arg_list);
-                va_end(arg_list);
-                std::string message;
-                if (bspace >= 0) {
-                    _indent += bspace;
-                    if (_indent <= 0) {
-                        _indent = 0;
-                    } else {
-                        message.append(_indent, _fill);
-                    }
-                }
-                message.append(msg);
-                if (aspace < 0) {
-                    _indent += aspace;
-                    if (_indent <= 0) {
-                        _indent = 0;
-                    }
+        static void file_flush() {
+            size_t used = _pending_size.load(std::memory_order_relaxed);
+            if (used > 0) {
+                if (_ofs.is_open()) {
+                    _ofs.write(_pending, static_cast<std::streamsize> (used));
                 }
-                std::cout << message << std::flush;
+                _pending_size.store(0, std::memory_order_release);
+            }
+            if (_ofs.is_open()) {
+                _ofs.flush();
             }
-            return std::cout;
         }
 
         /*
-         * @function save: save message to file no matter which kind of model log system is opened.
-         *                 however, it is controlled by @level, just like @_flag print flags
-         * @params
-         *   @level level for logging
-         *   @filename file @filename to logging message
-         *   @mode mode for open file @filename
-         *   @format formatted message to log
+         * @function unmap: close the memory mapped sink, queued records are written first
          */
-        template <unsigned short level=0x7F00>
-        static bool save(const std::string &filename, std::ios_base::openmode mode, const char* format, ...) {
-            bool ret = false;
-            if (format != nullptr && !masked(level)) {
-                std::ofstream& ofs(filename);
-                if (!ofs.fail()) {
-                    char * msg = nullptr;
-                    va_list arg_list;
-                    va_start(arg_list, format);
-                    msg = va_format(format, arg_list);
-                    va_end(arg_list);
-                    ofs << msg << std::flush;
-                    ret = true;
-                    ofs.close();
-                }
+        static void unmap() {
+            flush();
+            std::lock_guard<std::mutex> lock(_sink_mutex);
+            if (_mapped != nullptr) {
+                _mapped->close();
+                delete _mapped;
+                _mapped = nullptr;
             }
-            return ret;
         }
 
-        template <size_t num = 10, bool brief = true, unsigned short level=0x7F00>
-        static void line(size_t ith, size_t total, const char * format, ...) {
-	    if (masked(level))
-	        return;
-            assert(num != 0 && total != 0);
-            if (format != nullptr) {
-                char * msg = nullptr;
-                va_list arg_list;
-                va_start(arg_list, format);
-                msg = va_format(format, arg_list);
-                va_end(arg_list);
+        /*
+         * @function swap: put the stream prepared by the rotation thread in place of @_ofs
+         */
+        static void swap() {
+            std::unique_lock<std::mutex> lock(_rotation->_mutex);
+            std::ofstream *next = _rotation->_next.exchange(nullptr);
+            if (next != nullptr) {
+                file_flush();
+                _ofs.swap(*next);
+                _rotation->_written = 0;
+                _rotation->_retired.store(next);
+                lock.unlock();
+                _rotation->_cv.notify_one();
+            }
+            _rotation->_due.store(false);
+        }
 
-                ++ith;
+        static std::string text(const std::string &msg) {
+            return msg;
+        }
 
-                double size = total / static_cast<double> (num);
+        static std::string text(const char *msg) {
+            return msg == nullptr ? std::string() : std::string(msg);
+        }
+
+        template <typename T>
+        static std::string text(const T &msg) {
+            std::ostringstream os;
+            os << msg;
+            return os.str();
+        }
+
+        /*
+         * @function header: append the "[time L] => " prefix of a log line in @color to @out
+         */
+        static void header(std::string &out, char level, u::string::fore_color_type color) {
+            static const std::vector<std::string> palette = colors();
+            char text[96];
+            int n = u::format_to(text, sizeof(text), "[%s %c] => ", stamp(), level);
+            out.append(palette[color]);
+            out.append(text, std::min<size_t> (n, sizeof(text) - 1));
+            out.append("\033[0m");
+        }
+
+        static std::vector<std::string> colors() {
+            std::vector<std::string> ret;
+            for (int i = 0; i <= u::string::fore_none; ++i) {
+                ret.push_back("\033[" + u::string::fore_color(static_cast<u::string::fore_color_type> (i)) + "m");
+            }
+            return ret;
+        }
+
+        /*
+         * @function record: line under construction on the calling thread, emptied
+         */
+        static std::string &record() {
+            static thread_local std::string line;
+            line.clear();
+            return line;
+        }
+
+        /*
+         * @function indentation: indent of the calling thread, starting again from the one
+         *                        given to open after each open
+         */
+        static int &indentation() {
+            static thread_local int local = 0;
+            static thread_local unsigned seen = ~0U;
+            unsigned generation = _indent_generation.load(std::memory_order_acquire);
+            if (seen != generation) {
+                seen = generation;
+                local = _indent;
+            }
+            return local;
+        }
+
+        /*
+         * log_stage: records of one thread not handed to the sinks yet, they are written as
+         *            a whole so lines of different threads never mix. stages are never freed:
+         *            a thread takes a free one on its first held record and gives it back when
+         *            it exits, so the crash handler can walk them without a lock
+         */
+        struct log_stage {
+            char _data[64 * 1024];
+            std::atomic<size_t> _size;            // bytes used in @_data, read by the crash handler
+            std::atomic<unsigned short> _flag;
+            std::atomic<bool> _taken;
+            log_stage *_next;                     // all stages are linked for the crash handler, set once
+
+            log_stage() : _size(0), _flag(0), _taken(true), _next(nullptr) {
+            }
+        };
+
+        /*the stage a thread holds, given back when the thread exits*/
+        struct log_stage_owner {
+            log_stage *_stage;
+
+            log_stage_owner() : _stage(nullptr) {
+            }
+
+            ~log_stage_owner() {
+                if (_stage != nullptr) {
+                    commit(*_stage);
+                    _stage->_taken.store(false);
+                }
+            }
+        };
+
+        static std::atomic<log_stage*> &stages() {
+            static std::atomic<log_stage*> head(nullptr);
+            return head;
+        }
+
+        static log_stage_owner &stage_owner() {
+            static thread_local log_stage_owner owner;
+            return owner;
+        }
+
+        /*stage of the calling thread, a free one or a new one on first use*/
+        static log_stage &staging() {
+            log_stage_owner &owner = stage_owner();
+            for (log_stage *s = stages().load(); s != nullptr && owner._stage == nullptr; s = s->_next) {
+                bool taken = false;
+                if (s->_taken.compare_exchange_strong(taken, true)) {
+                    owner._stage = s;
+                }
+            }
+            if (owner._stage == nullptr) {
+                log_stage *s = new log_stage();
+                s->_next = stages().load();
+                while (!stages().compare_exchange_weak(s->_next, s)) {
+                }
+                owner._stage = s;
+            }
+            return *owner._stage;
+        }
+
+        /*
+         * @function stage: write @msg, or hold it in the stage of the calling thread until
+         *                  @_stage_size bytes are gathered
+         */
+        template <typename T>
+        static void stage(const T &msg, unsigned short flag) {
+            log_stage *s = stage_owner()._stage;
+            bool flush = (flag & u::FLUSH) == u::FLUSH || (_flag & u::FLUSH) == u::FLUSH;
+            if ((flush || _stage_size == 0) && (s == nullptr || s->_size.load(std::memory_order_relaxed) == 0)) {
+                std::lock_guard<std::mutex> lock(_sink_mutex);
+                write(msg, flag, true);
+            } else {
+                hold(msg, flag, flush);
+            }
+        }
+
+        static void hold(const std::string &msg, unsigned short flag, bool flush) {
+            hold(msg.data(), msg.size(), flag, flush);
+        }
+
+        static void hold(const char *msg, unsigned short flag, bool flush) {
+            if (msg != nullptr) {
+                hold(msg, strlen(msg), flag, flush);
+            }
+        }
+
+        template <typename T>
+        static void hold(const T &msg, unsigned short flag, bool flush) {
+            hold(text(msg), flag, flush);
+        }
+
+        static void hold(const char *data, size_t size, unsigned short flag, bool flush) {
+            log_stage &s = staging();
+            size_t used = s._size.load(std::memory_order_relaxed);
+            if (used != 0 && (s._flag.load(std::memory_order_relaxed) != flag || used + size > sizeof(s._data))) {
+                commit(s);
+                used = 0;
+            }
+            if (size >= sizeof(s._data)) {
+                std::lock_guard<std::mutex> lock(_sink_mutex);
+                write(std::string(data, size), flag, true);
+                return;
+            }
+            s._flag.store(flag, std::memory_order_relaxed);
+            memcpy(s._data + used, data, size);
+            s._size.store(used + size, std::memory_order_release);
+            if (used + size >= std::min(_stage_size, sizeof(s._data)) || flush) {
+                commit(s);
+            }
+        }
+
+        static void commit(log_stage &s) {
+            size_t used = s._size.load(std::memory_order_relaxed);
+            if (used != 0) {
+                std::lock_guard<std::mutex> lock(_sink_mutex);
+                write(std::string(s._data, used), s._flag.load(std::memory_order_relaxed), true);
+                s._size.store(0, std::memory_order_release);
+            }
+        }
+
+        static void enqueue(std::string &&msg, unsigned short flag) {
+            log_backend::record r;
+            r._text = std::move(msg);
+            r._flag = flag;
+            while (!_backend->_ring.push(std::move(r))) {
+                if (_backend->_policy != log_backend::block) {
+                    _backend->_dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                _backend->wake();
+                std::this_thread::yield();
+            }
+            _backend->_queued.fetch_add(1);
+            if (_backend->_ring.size() >= _backend->_high) {
+                _backend->wake();
+            }
+        }
+
+        /*
+         * @function halt: the crash handler asked for the sinks, the background writer lets
+         *                 go of them until the handler is done. it only comes back when the
+         *                 process survives the signal
+         */
+        static void halt(log_backend &b) {
+            int asked = 1;
+            if (b._crashing.compare_exchange_strong(asked, 2)) {
+                while (b._crashing.load() == 2) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+        }
+
+        /*
+         * @function drain: body of the background writer
+         */
+        static void drain() {
+            log_backend &b = *_backend;
+            log_backend::record r;
+            while (true) {
+                if (b._crashing.load() != 0) {
+                    halt(b);
+                }
+                bool any = false;
+                unsigned long long batch = 0;
+                std::unique_lock<std::mutex> sink(_sink_mutex);
+                /*one batch is at most a ring full, so a steady stream still gets flushed*/
+                while (batch < b._ring.capacity() && b._crashing.load(std::memory_order_relaxed) == 0 && b._ring.pop(r)) {
+                    write(r._text, r._flag, false);
+                    ++batch;
+                }
+                if (b._crashing.load() != 0) {
+                    sink.unlock();
+                    halt(b);
+                    sink.lock();
+                }
+                if (batch != 0) {
+                    b._written.fetch_add(batch);
+                    any = true;
+                }
+                if (b._policy == log_backend::count) {
+                    unsigned long long lost = b._dropped.load(std::memory_order_relaxed);
+                    if (lost != b._reported) {
+                        std::ostringstream os;
+                        os << "[log] " << (lost - b._reported) << " messages dropped\n";
+                        write(os.str(), u::D, false);
+                        b._reported = lost;
+                        any = true;
+                    }
+                }
+                if (any) {
+                    if ((_flag & u::F) == u::F) {
+                        file_flush();
+                    }
+                    if ((_flag & u::T) == u::T) {
+                        std::cout << std::flush;
+                    }
+                    sink.unlock();
+                    std::lock_guard<std::mutex> lock(b._mutex);
+                    b._idle.notify_all();
+                } else {
+                    sink.unlock();
+                }
+                if (b._stop.load() && b._ring.empty()) {
+                    break;
+                }
+                if (batch >= b._ring.capacity()) {
+                    continue; // still behind, no sleep
+                }
+                std::unique_lock<std::mutex> lock(b._mutex);
+                b._sleeping.store(true);
+                b._cv.wait_for(lock, b._period, [&b] {
+                    return b.urgent();
+                });
+                b._sleeping.store(false);
+            }
+        }
+
+    public:
+
+        /*
+         * @function open: open log system for logging
+         * @params
+         *   @flag for controlling whether log or not, the meaning of each bit is
+         *         explained as follow:
+         *                   |-- MMAP flag: write the file through a memory map instead of a stream
+         *                   ||-- FLUSH flag: enable flush stream after each printing
+         * _flag: 00000000 00000000
+         *        |-------     ||||_ Default flag
+         *        |||||||      |||__ File flag: logging to file @_filename instead of terminal
+         *        |||||||      ||___ Term flag: print message to terminal
+         *        |||||||      |____ Log open flag: record whether log system is opened or not
+         *        |||||||- Print flag: print level flag, that is, message will be printed only if corresponding bit is set
+         *        ||||||- Model flag, if set, print flag compared by bit, else by relation
+         *        |||||- Fatal flag
+         *        ||||- Error flag
+         *        |||- Warning flag
+         *        ||- Info flag
+         *        |- Debug flag
+         *   For example, if we want to debug, then set the most left bit to be 1.
+         *   @indent for printing @indent @fill before printing message
+         *           for example, if @indent = 4, and @fill = '*', it prints "***hello world" instead of "hello world".
+         *   @fill see @indent
+         *   @filename filename to logging message if @flag File bit is set
+         *   @mode mode to open @filename
+         *   the sinks of a previous open are released first: staged and queued messages are
+         *   written to them, rotation stops, the file is unmapped or closed. asynchronous mode
+         *   stays on, its writer is stopped meanwhile. not to be called while other threads
+         *   are logging
+         */
+        static bool open(unsigned short flag = (u::D | 0x7F00), int indent = 0, char fill = ' ', const std::string &filename = std::string(), std::ios_base::openmode mode = std::ofstream::out | std::ofstream::app) {
+            size_t capacity = 0;
+            log_backend::overflow policy = log_backend::block;
+            if (_backend != nullptr) {
+                capacity = _backend->_ring.capacity();
+                policy = _backend->_policy;
+            }
+            flush();
+            sync();
+            stop_rotate();
+            unmap();
+            if (_ofs.is_open()) {
+                std::lock_guard<std::mutex> lock(_sink_mutex);
+                file_flush();
+                _ofs.close();
+            }
+            u::string::free(&_filename);
+            init();
+            bool ret = true;
+            if ((flag & u::D) == u::D) {
+                _flag = ((u::T | u::FLUSH) | (flag & 0xFF00));
+            } else {
+                _flag = flag;
+                if ((flag & (u::F | u::T)) == (u::F | u::T) || (flag & u::F) == u::F) {
+                    if (filename.empty()) {
+                        ret = false;
+                    } else {
+                        _filename = u::string::dup(filename);
+                        if ((flag & u::MMAP) == u::MMAP) {
+                            _mapped = log_mapped::open(_filename, (mode & std::ofstream::trunc) == std::ofstream::trunc);
+                            ret = (_mapped != nullptr);
+                            static bool registered = false;
+                            if (ret && !registered) {
+                                registered = true;
+                                std::atexit(&log::unmap);
+                            }
+                        } else {
+                            _ofs.open(_filename, mode);
+                            static bool registered = false;
+                            if (!registered) {
+                                registered = true;
+                                std::atexit(&log::persist);
+                            }
+                        }
+                    }
+                }
+            }
+            if (ret) {
+                _flag |= u::O;
+            }
+            _indent = indent;
+            _indent_generation.fetch_add(1, std::memory_order_release);
+            _fill = fill;
+            if (capacity != 0) {
+                async(capacity, policy);
+            }
+            return ret;
+        }
+
+        /*
+         * @function reopen: reopen log system. It only changes open bit of @_flag
+         */
+        static void reopen() {
+            if (! opened()) {
+                _flag |= u::O;
+            }
+        }
+
+        /*
+         * @function close: set open bit to 0 in @_flag
+         */
+        static void close() {
+            if (opened()) {
+                _flag &= 0xF7;
+            }
+        }
+
+        static void set_mode(const unsigned short flag) {
+            if (opened()) {
+                _flag &= 0xFDFF;
+                _flag |= (flag & 0x0200);
+            }
+        }
+
+        static void toggle_mode() {
+            if (opened()) {
+                if ((_flag & 0x0200) == 0x0200) {
+                    _flag &= 0xFDFF;
+                } else {
+                    _flag |= 0x0200;
+                }
+            }
+        }
+
+        /*
+         * @function term: print message to terminal no matter log system is opened or not.
+         * @params
+         *   @bspace print @bspace (>0) + @_indent @_fill before printing message
+         *   @aspace adjust @_indent when @aspace less than 0 (used for restore state)
+         *   @format formatted message to print
+         */
+        template <typename ...Args>
+        static std::ostream &term(int bspace, int aspace, const char *format, const Args &... args) {
+            if (format != nullptr) {
+                int &depth = indentation();
+                const char *msg = u::format_local(format, args...);
+                std::string message;
+                if (bspace >= 0) {
+                    depth += bspace;
+                    if (depth <= 0) {
+                        depth = 0;
+                    } else {
+                        message.append(depth, _fill);
+                    }
+                }
+                message.append(msg);
+                if (aspace < 0) {
+                    depth += aspace;
+                    if (depth <= 0) {
+                        depth = 0;
+                    }
+                }
+                std::cout << message << std::flush;
+            }
+            return std::cout;
+        }
+
+        /*
+         * @function save: save message to file no matter which kind of model log system is opened.
+         *                 however, it is controlled by @level, just like @_flag print flags
+         * @params
+         *   @level level for logging
+         *   @filename file @filename to logging message
+         *   @mode mode for open file @filename
+         *   @format formatted message to log
+         */
+        template <unsigned short level=0x7F00, typename ...Args>
+        static bool save(const std::string &filename, std::ios_base::openmode mode, const char *format, const Args &... args) {
+            bool ret = false;
+            if (format != nullptr && !masked(level)) {
+                std::ofstream ofs(filename.c_str(), mode);
+                if (!ofs.fail()) {
+                    const char *msg = u::format_local(format, args...);
+                    ofs << msg << std::flush;
+                    ret = true;
+                    ofs.close();
+                }
+            }
+            return ret;
+        }
+
+        /*
+         * @function line: redraw a progress line for item @ith of @total. it formats and
+         *                 writes on every call, for tight or multi-threaded loops use
+         *                 u::progress instead
+         */
+        template <size_t num = 10, bool brief = true, unsigned short level=0x7F00, typename ...Args>
+        static void line(size_t ith, size_t total, const char *format, const Args &... args) {
+	    if (masked(level))
+	        return;
+            assert(num != 0 && total != 0);
+            if (format != nullptr) {
+                const char *msg = u::format_local(format, args...);
+
+                ++ith;
+
+                double size = total / static_cast<double> (num);
                 size_t div = static_cast<size_t> (std::ceil(ith / size) - 1);
                 size_t step = std::ceil(num / static_cast<double> (total)) - 1;
                 if (step == 0)
@@ -302,129 +1199,234 @@ namespace u {
                 _ofs.close();
         }
 
+        /*
+         * @function async: switch to asynchronous logging, messages are queued and written
+         *                  by a background thread. calling it again changes nothing
+         * @params
+         *   @capacity number of messages the ring holds (rounded up to a power of 2)
+         *   @policy what to do when the ring is full, see log_backend::overflow
+         */
+        static void async(size_t capacity = 8192, log_backend::overflow policy = log_backend::block) {
+            if (_backend == nullptr) {
+                _backend = new log_backend(capacity, policy);
+                _backend->_thread = std::thread(&log::drain);
+                static bool registered = false;
+                if (!registered) {
+                    registered = true;
+                    std::atexit(&log::sync);
+                }
+            }
+        }
+
+        /*
+         * @function sync: write out everything queued, stop the background thread and
+         *                 go back to synchronous logging
+         */
+        static void sync() {
+            if (_backend != nullptr) {
+                _backend->_stop.store(true);
+                {
+                    std::lock_guard<std::mutex> lock(_backend->_mutex);
+                    _backend->_cv.notify_one();
+                }
+                _backend->_thread.join();
+                delete _backend;
+                _backend = nullptr;
+            }
+        }
+
+        /*
+         * @function flush: write the records staged by the calling thread and the file output
+         *                 gathered so far, and wait until every message queued so far has
+         *                 been written in async mode
+         */
+        static void flush() {
+            if (stage_owner()._stage != nullptr) {
+                commit(*stage_owner()._stage);
+            }
+            if (_backend == nullptr) {
+                std::lock_guard<std::mutex> lock(_sink_mutex);
+                file_flush();
+            } else {
+                unsigned long long target = _backend->_queued.load();
+                std::unique_lock<std::mutex> lock(_backend->_mutex);
+                ++_backend->_flushing;
+                while (_backend->_written.load() < target) {
+                    _backend->_cv.notify_one();
+                    _backend->_idle.wait_for(lock, std::chrono::milliseconds(10));
+                }
+                --_backend->_flushing;
+            }
+        }
+
+        /*
+         * @function buffer: let each thread gather up to @bytes (at most 64KB) of records
+         *                   before writing them (0, the default, writes every record at
+         *                   once). records are only held back when FLUSH is not set
+         */
+        static void buffer(size_t bytes) {
+            _stage_size = bytes;
+        }
+
+        /*
+         * @function dropped: number of messages discarded because the ring was full
+         */
+        static unsigned long long dropped() {
+            return _backend == nullptr ? 0 : _backend->_dropped.load();
+        }
+
+        /*
+         * @function rotate: rotate the log file once it grows beyond @size bytes or gets older
+         *                   than @interval seconds (0 disables either). rotated files are kept
+         *                   as <file>.1 (newest) ... <file>.@keep. the next file is prepared in
+         *                   advance with @preallocate bytes reserved (default: @size, at most 64MB)
+         * @return false if the log system does not write to a file
+         */
+        static bool rotate(size_t size, unsigned interval = 0, int keep = 5, size_t preallocate = static_cast<size_t> (-1)) {
+            if (_filename == nullptr || !_ofs.is_open()) {
+                return false;
+            }
+            stop_rotate();
+            if (preallocate == static_cast<size_t> (-1)) {
+                preallocate = std::min<size_t> (size, 64 << 20);
+            }
+            log_rotation *r = new log_rotation(_filename, size, std::chrono::seconds(interval), keep, preallocate);
+            r->_thread = std::thread(&log_rotation::run, r);
+            {
+                std::lock_guard<std::mutex> lock(_sink_mutex); // the async writer may be running
+                _rotation = r;
+            }
+            static bool registered = false;
+            if (!registered) {
+                registered = true;
+                std::atexit(&log::stop_rotate);
+            }
+            return true;
+        }
+
+        /*
+         * @function stop_rotate: stop rotating, the current file stays open
+         */
+        static void stop_rotate() {
+            if (_rotation != nullptr) {
+                flush();
+                log_rotation *r = _rotation;
+                {
+                    std::lock_guard<std::mutex> lock(_sink_mutex);
+                    _rotation = nullptr;
+                }
+                r->_stop.store(true);
+                {
+                    std::lock_guard<std::mutex> lock(r->_mutex);
+                    r->_cv.notify_one();
+                }
+                r->_thread.join();
+                std::ofstream *next = r->_next.exchange(nullptr);
+                if (next != nullptr) {
+                    delete next;
+                    ::unlink((r->_base + ".next").c_str());
+                }
+                std::ofstream *retired = r->_retired.exchange(nullptr);
+                if (retired != nullptr) {
+                    r->shift();
+                    delete retired;
+                }
+                delete r;
+            }
+        }
+
+        /*
+         * @function rotated: number of rotations done so far
+         */
+        static unsigned long long rotated() {
+            return _rotation == nullptr ? 0 : _rotation->_rotated.load();
+        }
+
         template <typename T = const std::string &>
         static std::ostream &print(T msg, unsigned short flag = (u::D | 0x7F00)) {
             if (opened() && !masked(flag)) {
-            if ((flag & u::D) == u::D) {
-                if ((_flag & (u::F | u::T)) == (u::F | u::T)) {
-                    _ofs << msg;
-                    std::cout << msg;
-                    if ((_flag & u::FLUSH) == u::FLUSH)
-                        std::cout << std::flush;
-                } else if ((_flag & u::F) == u::F && _ofs.is_open()) {
-                    _ofs << msg;
-                    if ((_flag & u::FLUSH) == u::FLUSH) {
-                       _ofs << std::flush;
-                    }
-                } else if ((_flag & u::T) == u::T) {
-                    std::cout << msg;
-                    if ((_flag & u::FLUSH) == u::FLUSH) {
-                        std::cout << std::flush;
-                    }
+                if (_backend != nullptr) {
+                    enqueue(text(msg), flag);
+                } else {
+                    stage(msg, flag);
                 }
-            } else if ((flag & (u::F | u::T)) == (u::T | u::F)) {
-                if (_ofs.is_open())
-                    _ofs << msg;
-                std::cout << msg;
-                if ((flag & u::FLUSH) == u::FLUSH)
-                    std::cout << std::flush;
-            } else if ((flag & u::F) == u::F && _ofs.is_open()) {
-                _ofs << msg;
-            } else if ((flag & u::T) == u::T) {
-                std::cout << msg;
-                if ((flag & u::FLUSH) == u::FLUSH)
-                    std::cout << std::flush;
-            }
             }
             return std::cout;
         }
 
-        template <unsigned short flag = (u::D | 0x7F00)>
-        static std::ostream &echo(const char *format, ...) {
+        template <unsigned short flag = (u::D | 0x7F00), typename ...Args>
+        static std::ostream &echo(const char *format, const Args &... args) {
             if (opened() && !masked(flag) && format != nullptr) {
-                char * msg = nullptr;
-                va_list arg_list;
-                va_start(arg_list, format);
-                msg = u::va_format(format, arg_list);
-                va_end(arg_list);
+                const char *msg = u::format_local(format, args...);
                 print(msg, flag);
             }
             return std::cout;
         }
 
-        template <unsigned short flag = (u::D | 0x7F00)>
-        static std::ostream& indent(int bspace, int aspace, const char *format, ...) {
+        template <unsigned short flag = (u::D | 0x7F00), typename ...Args>
+        static std::ostream& indent(int bspace, int aspace, const char *format, const Args &... args) {
             if (opened() && !masked(flag) && format != nullptr) {
-                char *format_msg = nullptr;
-                va_list arg_list;
-                va_start(arg_list, format);
-                format_msg = u::va_format(format, arg_list);
-                va_end(arg_list);
-                std::string msg;
+                int &depth = indentation();
+                const char *format_msg = u::format_local(format, args...);
+                std::string &msg = record();
                 if (bspace >= 0) {
-                    _indent += bspace;
-                    if (_indent < 0) {
-                        _indent = 0;
+                    depth += bspace;
+                    if (depth < 0) {
+                        depth = 0;
                     } else {
-                        msg.append(_indent, _fill);
+                        msg.append(depth, _fill);
                     }
                 }
                 msg.append(format_msg);
                 msg.append("\n");
-                print(msg.c_str(), flag);
+                print(msg, flag);
                 if (aspace < 0) {
-                    _indent += aspace;
-                    if (_indent < 0) {
-                        _indent = 0;
+                    depth += aspace;
+                    if (depth < 0) {
+                        depth = 0;
                     }
                 }
             }
             return std::cout;
         }
 
-        template <unsigned short flag = (u::D | 0x7F00)>
-        static std::ostream& indent(int space, const char *format, ...) {
+        template <unsigned short flag = (u::D | 0x7F00), typename ...Args>
+        static std::ostream& indent(int space, const char *format, const Args &... args) {
             if (opened() && !masked(flag) && format != nullptr) {
-                char *format_msg = nullptr;
-                va_list arg_list;
-                va_start(arg_list, format);
-                format_msg = u::va_format(format, arg_list);
-                va_end(arg_list);
-                std::string msg;
+                int &depth = indentation();
+                const char *format_msg = u::format_local(format, args...);
+                std::string &msg = record();
                 if (space >= 0) {
-                    _indent += space;
-                    if (_indent < 0) {
-                        _indent = 0;
+                    depth += space;
+                    if (depth < 0) {
+                        depth = 0;
                     } else {
-                        msg.append(_indent, _fill);
+                        msg.append(depth, _fill);
                     }
                 }
                 msg.append(format_msg);
                 msg.append("\n");
-                print(msg.c_str(), flag);
+                print(msg, flag);
                 if (space < 0) {
-                    _indent += space;
-                    if (_indent < 0) {
-                        _indent = 0;
+                    depth += space;
+                    if (depth < 0) {
+                        depth = 0;
                     }
                 }
             }
             return std::cout;
         }
 
-        template <unsigned short flag = (u::D | 0x7F00)>
-        static std::ostream& indent(const char *format, ...) {
+        template <unsigned short flag = (u::D | 0x7F00), typename ...Args>
+        static std::ostream& indent(const char *format, const Args &... args) {
             if (opened() && !masked(flag) && format != nullptr) {
-                char *format_msg = nullptr;
-                va_list arg_list;
-                va_start(arg_list, format);
-                format_msg = u::va_format(format, arg_list);
-                va_end(arg_list);
-                std::string msg;
-                msg.append(_indent, _fill);
+                int &depth = indentation();
+                const char *format_msg = u::format_local(format, args...);
+                std::string &msg = record();
+                msg.append(depth, _fill);
                 msg.append(format_msg);
                 msg.append("\n");
-                print(msg.c_str(), flag);
+                print(msg, flag);
             }
             return std::cout;
         }
@@ -432,22 +1434,22 @@ namespace u {
         template <unsigned short flag = (u::D | 0x7F00)>
         static void indent(int spaces) {
             if (opened() && !masked(flag)) {
-                _indent += spaces;
-                if (_indent <= 0) {
-                    _indent = 0;
+                int &depth = indentation();
+                depth += spaces;
+                if (depth <= 0) {
+                    depth = 0;
                 }
             }
         }
 
-        static std::ostream& debug(const char *format, ...) {
-            if (opened() && !masked(0x8000) && format != nullptr) {
-                char *format_msg = nullptr;
-                va_list arg_list;
-                va_start(arg_list, format);
-                format_msg = u::va_format(format, arg_list);
-                va_end(arg_list);
-                std::string msg(u::string::styled_string(u::format("[%s D] => ", now().c_str()), u::string::fore_magenta));
-                msg.append(_indent, _fill);
+        template <typename ...Args>
+        static std::ostream& debug(const char *format, const Args &... args) {
+            if (!stripped(0x8000) && enabled(0x8000) && format != nullptr) {
+                int &depth = indentation();
+                const char *format_msg = u::format_local(format, args...);
+                std::string &msg = record();
+                header(msg, 'D', u::string::fore_magenta);
+                msg.append(depth, _fill);
                 msg.append(format_msg);
                 msg.append("\n");
                 print(msg, (u::D|0x8000));
@@ -455,29 +1457,28 @@ namespace u {
             return std::cout;
         }
 
-        static std::ostream& debug(int bspace, int aspace, const char *format, ...) {
-            if (opened() && !masked(0x8000) && format != nullptr) {
-                char *format_msg = nullptr;
-                va_list arg_list;
-                va_start(arg_list, format);
-                format_msg = u::va_format(format, arg_list);
-                va_end(arg_list);
-                std::string msg(u::string::styled_string(u::format("[%s D] => ", now().c_str()), u::string::fore_magenta));
+        template <typename ...Args>
+        static std::ostream& debug(int bspace, int aspace, const char *format, const Args &... args) {
+            if (!stripped(0x8000) && enabled(0x8000) && format != nullptr) {
+                int &depth = indentation();
+                const char *format_msg = u::format_local(format, args...);
+                std::string &msg = record();
+                header(msg, 'D', u::string::fore_magenta);
                 if (bspace >= 0) {
-                    _indent += bspace;
-                    if (_indent < 0) {
-                        _indent = 0;
+                    depth += bspace;
+                    if (depth < 0) {
+                        depth = 0;
                     } else {
-                        msg.append(_indent, _fill);
+                        msg.append(depth, _fill);
                     }
                 }
                 msg.append(format_msg);
                 msg.append("\n");
                 print(msg, (u::D|0x8000));
                 if (aspace < 0) {
-                    _indent += aspace;
-                    if (_indent < 0) {
-                        _indent = 0;
+                    depth += aspace;
+                    if (depth < 0) {
+                        depth = 0;
                     }
                 }
             }
@@ -488,66 +1489,327 @@ namespace u {
             return ((_flag & u::O) == u::O);
         }
 
-        template <unsigned short flag = (u::D | 0x7F00)>
-        static std::ostream& info(const char* format, ...) {
-            if (opened() && format != nullptr) {
-                std::string msg(u::string::styled_string(u::format("[%s I] => ", now().c_str()), u::string::fore_blue));
-                va_list arg;
-                va_start(arg, format);
-                msg.append(va_format(format, arg));
-                va_end(arg);
+        /*
+         * @function stripped: whether @level is compiled out by U_LOG_STRIP
+         */
+        static constexpr bool stripped(unsigned short level) {
+            return (level & 0xFF00) != 0 && (level & 0xFF00 & U_LOG_STRIP) == (level & 0xFF00);
+        }
+
+        /*
+         * @function stripped: same for a message of @level sent with template @flag. a flag
+         *                     naming levels of its own (other than none or those of @preset,
+         *                     the default flag of the function) is stripped by those levels,
+         *                     e.g. info<u::D | 0x1000> goes with error, not with info
+         */
+        static constexpr bool stripped(unsigned short level, unsigned short flag, unsigned short preset) {
+            return stripped(((flag & 0xF800) == 0 || (flag & 0xF800) == (preset & 0xF800)) ? level : (flag & 0xF800));
+        }
+
+        /*
+         * @function enabled: whether a message of @level would be printed now, checked
+         *                    before any formatting takes place
+         */
+        static bool enabled(unsigned short level) {
+            return opened() && !masked(level);
+        }
+
+        /*default flags of debug() ... fatal(), named for the macros taking a level name*/
+        static constexpr unsigned short debug_flag = 0x8000;
+        static constexpr unsigned short info_flag = u::D | 0x7F00;
+        static constexpr unsigned short warning_flag = u::D | 0x7F00;
+        static constexpr unsigned short error_flag = u::D | 0xFF00;
+        static constexpr unsigned short fatal_flag = u::D | 0xFF00;
+
+        template <unsigned short flag = (u::D | 0x7F00), typename ...Args>
+        static std::ostream& info(const char *format, const Args &... args) {
+            if (!stripped(0x4000, flag, u::D | 0x7F00) && enabled(flag) && format != nullptr) {
+                std::string &msg = record();
+                header(msg, 'I', u::string::fore_blue);
+                msg.append(u::format_local(format, args...));
                 msg.append("\n");
                 print(msg, flag);
             }
             return std::cout;
         }
 
-        template <unsigned short flag = (u::D | 0x7F00)>
-        static std::ostream& warning(const char* format, ...) {
-            if (opened() && format != nullptr) {
-                std::string msg(u::string::styled_string(u::format("[%s W] => ", now().c_str()), u::string::fore_yellow));
-                va_list arg;
-                va_start(arg, format);
-                msg.append(va_format(format, arg));
-                va_end(arg);
+        template <unsigned short flag = (u::D | 0x7F00), typename ...Args>
+        static std::ostream& warning(const char *format, const Args &... args) {
+            if (!stripped(0x2000, flag, u::D | 0x7F00) && enabled(flag) && format != nullptr) {
+                std::string &msg = record();
+                header(msg, 'W', u::string::fore_yellow);
+                msg.append(u::format_local(format, args...));
                 msg.append("\n");
                 print(msg, flag);
             }
 	    return std::cout;
         }
 
-        template <unsigned short flag = (u::D | 0xFF00)>
-        static std::ostream& error(const char* format, ...) {
-            if (opened() && format != nullptr) {
-                std::string msg(u::string::styled_string(u::format("[%s E] => ", now().c_str()), u::string::fore_cyan));
-                va_list arg;
-                va_start(arg, format);
-                msg.append(va_format(format, arg));
-                va_end(arg);
+        template <unsigned short flag = (u::D | 0xFF00), typename ...Args>
+        static std::ostream& error(const char *format, const Args &... args) {
+            if (!stripped(0x1000, flag, u::D | 0xFF00) && enabled(flag) && format != nullptr) {
+                std::string &msg = record();
+                header(msg, 'E', u::string::fore_cyan);
+                msg.append(u::format_local(format, args...));
+                msg.append("\n");
+                print(msg, flag);
+            }
+            return std::cout;
+        }
+
+        template <unsigned short flag = (u::D | 0xFF00), typename ...Args>
+        static std::ostream& fatal(const char *format, const Args &... args) {
+            if (!stripped(0x0800, flag, u::D | 0xFF00) && enabled(flag) && format != nullptr) {
+                std::string &msg = record();
+                header(msg, 'F', u::string::fore_red);
+                msg.append(u::format_local(format, args...));
                 msg.append("\n");
                 print(msg, flag);
+                persist();
             }
             return std::cout;
         }
 
-        template <unsigned short flag = (u::D | 0xFF00)>
-        static std::ostream& fatal(const char*format, ...) {
-            if (opened() && format != nullptr) {
-                std::string msg(u::string::styled_string(u::format("[%s F] => ", now().c_str()), u::string::fore_red));
-                va_list arg;
-                va_start(arg, format);
-                msg.append(va_format(format, arg));
-                va_end(arg);
-                msg.append("\n");
-                print(msg, flag);
-            }
-            return std::cout;
+        /*
+         * @function persist: push everything logged so far down to the files: the stage of
+         *                    the calling thread, the async queue and the stream buffers.
+         *                    fatal() calls it after printing
+         */
+        static void persist() {
+            flush();
+            std::lock_guard<std::mutex> lock(_sink_mutex);
+            file_flush();
+            std::cout << std::flush;
+        }
+
+        /*
+         * @function guard: on SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT (and SIGTERM when @term)
+         *                  write out whatever u::log still holds, with async-signal-safe calls
+         *                  only, then let the signal take its default action. the handler
+         *                  runs on an alternate stack of the calling thread, so stack overflows
+         *                  of that thread are covered too. an async writer is asked to stop
+         *                  first, the handler waits for it at most half a second
+         */
+        static bool guard(bool term = true) {
+            static char stack[64 * 1024];
+            stack_t ss;
+            ss.ss_sp = stack;
+            ss.ss_size = sizeof(stack);
+            ss.ss_flags = 0;
+            ::sigaltstack(&ss, nullptr);
+            struct sigaction sa;
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_handler = &log::crashed;
+            sa.sa_flags = SA_RESETHAND | SA_ONSTACK;
+            sigemptyset(&sa.sa_mask);
+            const int signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGTERM};
+            bool ret = true;
+            for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); ++i) {
+                if (signals[i] == SIGTERM && !term) {
+                    continue;
+                }
+                ret = (::sigaction(signals[i], &sa, nullptr) == 0) && ret;
+            }
+            return ret;
+        }
+
+        /*
+         * @function crash_hook: extra function called by the crash handler, after u::log is saved
+         */
+        static void crash_hook(void (*hook)(int)) {
+            _crash_hook = hook;
+        }
+
+    private:
+        /*direct a record of @flag to @file and/or the terminal, see write*/
+        static void emergency(const char *data, size_t size, unsigned short flag, int file) {
+            unsigned short sinks = ((flag & u::D) == u::D) ? _flag : flag;
+            if ((sinks & u::F) == u::F) {
+                if (_mapped != nullptr && _mapped->_fd >= 0) {
+                    size_t at = _mapped->_offset.load();
+                    ssize_t n = ::pwrite(_mapped->_fd, data, size, static_cast<off_t> (at));
+                    if (n > 0) {
+                        _mapped->_offset.store(at + n);
+                    }
+                } else if (file >= 0) {
+                    raw_write(file, data, size);
+                }
+            }
+            if ((sinks & u::T) == u::T) {
+                raw_write(STDOUT_FILENO, data, size);
+            }
+        }
+
+        static void raw_write(int fd, const char *data, size_t size) {
+            while (size > 0) {
+                ssize_t n = ::write(fd, data, size);
+                if (n <= 0) {
+                    if (n < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    break;
+                }
+                data += n;
+                size -= n;
+            }
+        }
+
+        static void crashed(int sig) {
+            int saved = errno;
+            int file = -1;
+            if (_filename != nullptr && _mapped == nullptr) {
+                file = ::open(_filename, O_WRONLY | O_APPEND);
+            }
+            /*stop the async writer before touching what it writes, unless it is the one crashing*/
+            bool halted = false;
+            if (_backend != nullptr && !pthread_equal(::pthread_self(), _backend->_thread.native_handle())) {
+                _backend->_crashing.store(1);
+                halted = true;
+                struct timespec pause = {0, 1000000};
+                for (int i = 0; i < 500 && _backend->_crashing.load() != 2; ++i) {
+                    ::nanosleep(&pause, nullptr);
+                }
+            }
+            /*
+             * file output gathered but not handed to the stream yet. it and the stages below
+             * sit in fixed buffers with an atomic length, so no lock is needed. what threads
+             * still logging in sync mode add meanwhile may be missing or written twice
+             */
+            size_t pending = _pending_size.load(std::memory_order_acquire);
+            if (file >= 0 && pending > 0) {
+                raw_write(file, _pending, pending);
+                _pending_size.store(0);
+            }
+            /*records still queued for the async writer, popped without freeing anything*/
+            if (_backend != nullptr) {
+                alignas(log_backend::record) static char storage[sizeof(log_backend::record)];
+                log_backend::record *r = new (storage) log_backend::record();
+                while (_backend->_ring.pop(*r)) {
+                    emergency(r->_text.data(), r->_text.size(), r->_flag, file);
+                    r = new (storage) log_backend::record();
+                }
+            }
+            /*records staged by every thread*/
+            for (log_stage *s = stages().load(); s != nullptr; s = s->_next) {
+                size_t used = s->_size.load(std::memory_order_acquire);
+                if (used > 0) {
+                    emergency(s->_data, used, s->_flag.load(), file);
+                    s->_size.store(0);
+                }
+            }
+            if (_mapped != nullptr && _mapped->_fd >= 0) {
+                if (::ftruncate(_mapped->_fd, static_cast<off_t> (_mapped->_offset.load())) != 0) {
+                    /*the zero filled tail stays*/
+                }
+            }
+            if (file >= 0) {
+                ::close(file);
+            }
+            if (halted) {
+                _backend->_crashing.store(0); // what it holds is written, the writer may go on
+            }
+            if (_crash_hook != nullptr) {
+                _crash_hook(sig);
+            }
+            errno = saved;
+            ::raise(sig);
+        }
+
+    public:
+
+        static std::string now(const std::string &fmt="%a %F %H:%M:%S") {
+            return u::timer::stamp(fmt.c_str());
+        }
+
+        /*
+         * @function stamp: timestamp of log lines, served from the per-thread cache of
+         *                  u::timer::stamp without building a std::string
+         */
+        static const char *stamp() {
+            return u::timer::stamp("%a %F %H:%M:%S", _precision);
         }
 
-        static std::string now(const std::string &fmt="%a %F %H:%M:%S") {
-            return u::timer::now(fmt);
+        /*
+         * @function precision: sub-second digits of log timestamps, 0 (default), 3 or 6
+         */
+        static void precision(int digits) {
+            _precision = digits;
         }
 
+/*
+ * u_debug/u_info/u_warning/u_error/u_fatal: like the functions of the same name, but the
+ *   arguments are not even evaluated when the level is disabled, and the whole statement
+ *   vanishes when the level is in U_LOG_STRIP. they always send the default flag, calls
+ *   with a flag of their own (u::log::info<flag>) are stripped by the levels of that flag
+ */
+#if (U_LOG_STRIP & 0x8000)
+#define u_debug(...) ((void)0)
+#else
+#define u_debug(...) do { if (u::log::enabled(0x8000)) u::log::debug(__VA_ARGS__); } while (0)
+#endif
+
+#if (U_LOG_STRIP & 0x4000)
+#define u_info(...) ((void)0)
+#else
+#define u_info(...) do { if (u::log::enabled(u::D | 0x7F00)) u::log::info(__VA_ARGS__); } while (0)
+#endif
+
+#if (U_LOG_STRIP & 0x2000)
+#define u_warning(...) ((void)0)
+#else
+#define u_warning(...) do { if (u::log::enabled(u::D | 0x7F00)) u::log::warning(__VA_ARGS__); } while (0)
+#endif
+
+#if (U_LOG_STRIP & 0x1000)
+#define u_error(...) ((void)0)
+#else
+#define u_error(...) do { if (u::log::enabled(u::D | 0xFF00)) u::log::error(__VA_ARGS__); } while (0)
+#endif
+
+#if (U_LOG_STRIP & 0x0800)
+#define u_fatal(...) ((void)0)
+#else
+#define u_fatal(...) do { if (u::log::enabled(u::D | 0xFF00)) u::log::fatal(__VA_ARGS__); } while (0)
+#endif
+
+/*
+ * u_log_binary: record a message of @level (0x8000 debug ... 0x0800 fatal) in the binary
+ *   log of u::log_binary. @format is registered once per call site, the arguments are
+ *   stored raw and formatted only when the log is decoded
+ */
+#define u_log_binary(level, format, ...) do {                                                       \
+    if (!u::log::stripped(level)) {                                                                 \
+        static const unsigned __u_log_site = u::log_binary::define(level, format, __FILE__, __LINE__); \
+        if (u::log_binary::opened() && u::log::enabled(level))                                      \
+            u::log_binary::record(__u_log_site, ##__VA_ARGS__);                                     \
+    }                                                                                               \
+} while (0)
+
+/*
+ * u_log_sample: u::log::@level(...) for one call out of @n at this call site
+ * u_log_rate: u::log::@level(...) at most @per_second (> 0) times per second at this call
+ *   site, allowing bursts of @burst. the first message let through after some were
+ *   rejected is preceded by a "suppressed K messages" line
+ *   e.g. u_log_rate(warning, 10, 20, "retrying %s", host);
+ * @level is one of debug, info, warning, error and fatal. a masked level is checked first
+ *   and leaves the counters alone, so it does not use up the budget of the enabled ones
+ */
+#define u_log_sample(level, n, ...) do {                                                            \
+    static u::log_limit __u_log_limit;                                                              \
+    if (u::log::enabled(u::log::level##_flag) && __u_log_limit.sample(n))                           \
+        u::log::level(__VA_ARGS__);                                                                 \
+} while (0)
+
+#define u_log_rate(level, per_second, burst, ...) do {                                              \
+    static u::log_limit __u_log_limit;                                                              \
+    if (u::log::enabled(u::log::level##_flag) && __u_log_limit.rate(per_second, burst)) {           \
+        unsigned long long __u_log_suppressed = __u_log_limit.suppressed();                         \
+        if (__u_log_suppressed > 0)                                                                 \
+            u::log::level("suppressed %llu messages at %s:%d", __u_log_suppressed, __FILE__, __LINE__); \
+        u::log::level(__VA_ARGS__);                                                                 \
+    }                                                                                               \
+} while (0)
+
 #define u_fun_enter(a,b) {u::log::debug(a, b, "[%s:%d `%s`] ENTER", __FILE__, __LINE__, __FUNCTION__);}
 #define u_fun_exit(a,b) {u::log::debug(a, b, "[%s:%d `%s`] EXIT", __FILE__, __LINE__, __FUNCTION__);}
 #define u_fun_here(a,b) {u::log::debug(a, b, "[%s:%d `%s`] HERE", __FILE__, __LINE__, __FUNCTION__);}
@@ -620,6 +1882,760 @@ namespace u {
 #endif
 
     };
+
+    /*
+     * progress: progress report for loops over many items, possibly spread over threads.
+     *           counting an item is a relaxed atomic add; a background thread repaints
+     *           "title [=====>    ] 45.2% 4520/10000 12.3k/s ETA 00:00:04" every @period
+     *           and finish() (or the destructor) paints the final state. a @total of 0
+     *           shows count and throughput only
+     *
+     *   u::progress bar(files.size(), "indexing");
+     *   u::ws::parallel_for_each(ws, files.begin(), files.end(), [&](const std::string &f) {
+     *       index(f);
+     *       ++bar;
+     *   });
+     *   bar.finish();
+     */
+    class progress {
+    private:
+        std::atomic<size_t> _done;
+        size_t _total;
+        std::string _title;
+        size_t _width;
+        std::chrono::milliseconds _period;
+        std::chrono::steady_clock::time_point _start;
+        double _rate; // smoothed items per second
+        size_t _last;
+        std::chrono::steady_clock::time_point _last_time;
+        bool _stop;
+        bool _finished;
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        std::thread _thread;
+
+        progress(const progress &);
+        progress &operator=(const progress &);
+
+        static void human(char *out, size_t size, double value) {
+            const char *units = " kMGT";
+            int unit = 0;
+            while (value >= 1000.0 && unit < 4) {
+                value /= 1000.0;
+                ++unit;
+            }
+            if (unit == 0) {
+                u::format_to(out, size, "%.1f", value);
+            } else {
+                u::format_to(out, size, "%.1f%c", value, units[unit]);
+            }
+        }
+
+        void paint(bool last) {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            size_t done = _done.load(std::memory_order_relaxed);
+            double elapsed = std::chrono::duration<double>(now - _start).count();
+            double span = std::chrono::duration<double>(now - _last_time).count();
+            if (span > 0) {
+                double rate = (done - _last) / span;
+                _rate = (_last_time == _start) ? rate : 0.7 * _rate + 0.3 * rate;
+            }
+            _last = done;
+            _last_time = now;
+            double rate = last && elapsed > 0 ? done / elapsed : _rate;
+
+            char speed[32];
+            human(speed, sizeof(speed), rate);
+            char bar[256];
+            size_t width = std::min<size_t> (_width, sizeof(bar) - 1);
+            char text[512];
+            if (_total > 0) {
+                size_t shown = std::min(done, _total);
+                size_t fill = width * shown / _total;
+                for (size_t i = 0; i < width; ++i) {
+                    bar[i] = i < fill ? '=' : (i == fill ? '>' : ' ');
+                }
+                bar[width] = '\0';
+                long eta = (rate > 0 && done < _total) ? static_cast<long> ((_total - done) / rate) : 0;
+                u::format_to(text, sizeof(text), "\r%s [%s] %5.1f%% %zu/%zu %s/s ETA %02ld:%02ld:%02ld",
+                             _title, bar, 100.0 * shown / _total, done, _total, speed,
+                             eta / 3600, eta / 60 % 60, eta % 60);
+            } else {
+                long spent = static_cast<long> (elapsed);
+                u::format_to(text, sizeof(text), "\r%s %zu %s/s %02ld:%02ld:%02ld",
+                             _title, done, speed, spent / 3600, spent / 60 % 60, spent % 60);
+            }
+            u::log::term(0, 0, last ? "%s\n" : "%s", text);
+        }
+
+        void run() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (!_stop) {
+                _cv.wait_for(lock, _period);
+                if (!_stop) {
+                    paint(false);
+                }
+            }
+        }
+
+    public:
+
+        /*
+         * @params
+         *   @total number of items expected, 0 if unknown
+         *   @title text in front of the bar
+         *   @period time between two repaints
+         *   @width characters of the bar
+         */
+        progress(size_t total, const std::string &title = std::string(), unsigned period = 200, size_t width = 30) :
+            _done(0), _total(total), _title(title), _width(width), _period(period), _start(std::chrono::steady_clock::now()),
+            _rate(0), _last(0), _last_time(_start), _stop(false), _finished(false) {
+            _thread = std::thread(&progress::run, this);
+        }
+
+        ~progress() {
+            finish();
+        }
+
+        /*
+         * @function tick: count @n more items done
+         */
+        void tick(size_t n = 1) {
+            _done.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        progress &operator++() {
+            _done.fetch_add(1, std::memory_order_relaxed);
+            return *this;
+        }
+
+        progress &operator+=(size_t n) {
+            _done.fetch_add(n, std::memory_order_relaxed);
+            return *this;
+        }
+
+        size_t done() const {
+            return _done.load(std::memory_order_relaxed);
+        }
+
+        /*
+         * @function finish: stop repainting and paint the final state on its own line
+         */
+        void finish() {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (_finished) {
+                    return;
+                }
+                _finished = true;
+                _stop = true;
+                _cv.notify_one();
+            }
+            _thread.join();
+            paint(true);
+        }
+    };
+
+    /*
+     * log_binary: deferred formatting log. a call site records the id of its format string
+     *             plus the raw bytes of its arguments into a buffer owned by the calling
+     *             thread; text is only produced later by decode() (see tools/u-log-decode.cpp).
+     *             layout of the file, integers in host byte order:
+     *               header     "ULOGBIN1"
+     *               definition 'D' u32 id, u16 level, u32 line, u16 length, file, u16 length, format
+     *               event      'E' u32 id, u32 thread, u64 nanoseconds since epoch, u32 length, arguments
+     *               argument   'i' i64 | 'u' u64 | 'd' double | 'c' char | 'p' u64 | 's' u32 length, bytes
+     *             use it through the u_log_binary macro
+     */
+    template <typename static_members>
+    struct log_binary_static_holder
+    {
+        static int _fd;
+        static std::mutex _mutex;
+        static std::vector<std::string> _definitions;
+        static std::atomic<unsigned> _threads;
+        static std::atomic<unsigned long long> _offset; // end of the file, reserved by put
+    };
+
+    template<typename static_members>
+    int log_binary_static_holder<static_members>::_fd = -1;
+
+    template<typename static_members>
+    std::mutex log_binary_static_holder<static_members>::_mutex;
+
+    template<typename static_members>
+    std::vector<std::string> log_binary_static_holder<static_members>::_definitions;
+
+    template<typename static_members>
+    std::atomic<unsigned> log_binary_static_holder<static_members>::_threads;
+
+    template<typename static_members>
+    std::atomic<unsigned long long> log_binary_static_holder<static_members>::_offset;
+
+    class log_binary : public log_binary_static_holder<void> {
+    private:
+        enum {
+            capacity = 64 * 1024, // bytes buffered per thread
+            max_string = 4096     // longer string arguments are cut
+        };
+
+        struct buffer {
+            char _data[capacity];
+            size_t _size;
+            unsigned _thread;
+
+            buffer() : _size(0), _thread(_threads.fetch_add(1)) {
+                current() = this;
+            }
+
+            ~buffer() {
+                current() = nullptr;
+                flush();
+            }
+
+            void flush() {
+                if (_size > 0) {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    put(_data, _size);
+                    _size = 0;
+                }
+            }
+        };
+
+        /*buffer of the calling thread if it has one, plain pointer the crash handler can read*/
+        static buffer *&current() {
+            static thread_local buffer *b = nullptr;
+            return b;
+        }
+
+        static buffer &local() {
+            static thread_local buffer b;
+            return b;
+        }
+
+        /*
+         * write @size bytes at the end of the file. the bytes are reserved in @_offset first,
+         * so writers never overlap, even the crash handler which cannot take @_mutex
+         */
+        static void put(const char *data, size_t size) {
+            int fd = _fd;
+            if (fd < 0 || size == 0) {
+                return;
+            }
+            unsigned long long at = _offset.fetch_add(size);
+            while (size > 0) {
+                ssize_t n = ::pwrite(fd, data, size, static_cast<off_t> (at));
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    break;
+                }
+                data += n;
+                size -= n;
+                at += n;
+            }
+        }
+
+        template <typename T>
+        static char *raw(char *p, T value) {
+            memcpy(p, &value, sizeof(T));
+            return p + sizeof(T);
+        }
+
+        static size_t bounded(const char *s) {
+            return s == nullptr ? 0 : strnlen(s, max_string);
+        }
+
+        /*size of the encoded argument*/
+        template <typename T>
+        static typename std::enable_if<std::is_arithmetic<T>::value || std::is_pointer<T>::value, size_t>::type
+        measure(const T &) {
+            return 1 + (std::is_same<T, char>::value ? 1 : 8);
+        }
+
+        static size_t measure(const char *s) {
+            return 5 + bounded(s);
+        }
+
+        static size_t measure(char *s) {
+            return 5 + bounded(s);
+        }
+
+        static size_t measure(const std::string &s) {
+            return 5 + std::min<size_t> (s.size(), max_string);
+        }
+
+        static size_t measure() {
+            return 0;
+        }
+
+        template <typename T, typename ...Args>
+        static size_t measure(const T &first, const Args &... rest) {
+            return measure(first) + measure(rest...);
+        }
+
+        static char *encode(char *p, char value) {
+            *p++ = 'c';
+            *p++ = value;
+            return p;
+        }
+
+        template <typename T>
+        static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, char*>::type
+        encode(char *p, T value) {
+            *p++ = 'i';
+            return raw(p, static_cast<long long> (value));
+        }
+
+        template <typename T>
+        static typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, char*>::type
+        encode(char *p, T value) {
+            *p++ = 'u';
+            return raw(p, static_cast<unsigned long long> (value));
+        }
+
+        template <typename T>
+        static typename std::enable_if<std::is_floating_point<T>::value, char*>::type
+        encode(char *p, T value) {
+            *p++ = 'd';
+            return raw(p, static_cast<double> (value));
+        }
+
+        template <typename T>
+        static char *encode(char *p, T *value) {
+            *p++ = 'p';
+            return raw(p, static_cast<unsigned long long> (reinterpret_cast<uintptr_t> (value)));
+        }
+
+        static char *encode(char *p, const char *value, size_t size) {
+            *p++ = 's';
+            p = raw(p, static_cast<uint32_t> (size));
+            if (size > 0) {
+                memcpy(p, value, size);
+            }
+            return p + size;
+        }
+
+        static char *encode(char *p, const char *value) {
+            return encode(p, value, bounded(value));
+        }
+
+        static char *encode(char *p, char *value) {
+            return encode(p, value, bounded(value));
+        }
+
+        static char *encode(char *p, const std::string &value) {
+            return encode(p, value.data(), std::min<size_t> (value.size(), max_string));
+        }
+
+        static char *encode_all(char *p) {
+            return p;
+        }
+
+        template <typename T, typename ...Args>
+        static char *encode_all(char *p, const T &first, const Args &... rest) {
+            return encode_all(encode(p, first), rest...);
+        }
+
+        static void definition(std::string &out, unsigned id, const std::string &body) {
+            char head[5];
+            head[0] = 'D';
+            raw(head + 1, static_cast<uint32_t> (id));
+            out.append(head, sizeof(head));
+            out.append(body);
+        }
+
+        log_binary() {
+        }
+
+    public:
+
+        /*
+         * @function open: start writing binary records to @filename, definitions of the call
+         *                 sites met so far are written right after the header. with @append
+         *                 the header is only written when the file is empty, a later session
+         *                 redefines the ids it uses
+         */
+        static bool open(const std::string &filename, bool append = false) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_fd >= 0) {
+                ::close(_fd);
+            }
+            _fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | (append ? 0 : O_TRUNC), 0644);
+            if (_fd < 0) {
+                return false;
+            }
+            struct stat st;
+            _offset.store((append && ::fstat(_fd, &st) == 0) ? static_cast<unsigned long long> (st.st_size) : 0);
+            std::string out;
+            if (_offset.load() == 0) {
+                out.append("ULOGBIN1");
+            }
+            for (size_t i = 0; i < _definitions.size(); ++i) {
+                definition(out, i, _definitions[i]);
+            }
+            put(out.data(), out.size());
+            log::crash_hook(&log_binary::crashed);
+            return true;
+        }
+
+        /*
+         * @function close: flush the buffer of the calling thread and close the file. buffers
+         *                  of other threads are written when they fill up or their thread exits
+         */
+        static void close() {
+            local().flush();
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_fd >= 0) {
+                ::close(_fd);
+                _fd = -1;
+            }
+        }
+
+        static bool opened() {
+            return _fd >= 0;
+        }
+
+        /*
+         * @function flush: write the buffer of the calling thread
+         */
+        static void flush() {
+            local().flush();
+        }
+
+        /*
+         * @function crashed: save the buffer of the crashing thread, called from the crash
+         *                    handler of u::log::guard, so only with async-signal-safe calls:
+         *                    a thread which never recorded anything has no buffer to create
+         */
+        static void crashed(int) {
+            buffer *b = current();
+            if (b != nullptr && b->_size > 0) {
+                put(b->_data, b->_size);
+                b->_size = 0;
+            }
+        }
+
+        /*
+         * @function define: register a call site, returns the id its events refer to
+         */
+        static unsigned define(unsigned short level, const char *format, const char *file, unsigned line) {
+            std::string body;
+            char fixed[6];
+            raw(raw(fixed, static_cast<uint16_t> (level)), static_cast<uint32_t> (line));
+            body.append(fixed, sizeof(fixed));
+            size_t length = bounded(file);
+            raw(fixed, static_cast<uint16_t> (length));
+            body.append(fixed, 2).append(file, length);
+            length = std::min<size_t> (strlen(format), 0xFFFF);
+            raw(fixed, static_cast<uint16_t> (length));
+            body.append(fixed, 2).append(format, length);
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            unsigned id = _definitions.size();
+            _definitions.push_back(body);
+            if (_fd >= 0) {
+                std::string out;
+                definition(out, id, body);
+                put(out.data(), out.size());
+            }
+            return id;
+        }
+
+        /*
+         * @function record: append an event of call site @id with arguments @args
+         */
+        template <typename ...Args>
+        static void record(unsigned id, const Args &... args) {
+            size_t payload = measure(args...);
+            size_t size = 21 + payload;
+            buffer &b = local();
+            if (b._size + size > capacity) {
+                b.flush();
+            }
+            std::vector<char> large;
+            char *p = b._data + b._size;
+            if (size > capacity) {
+                large.resize(size);
+                p = large.data();
+            }
+            char *start = p;
+            *p++ = 'E';
+            p = raw(p, static_cast<uint32_t> (id));
+            p = raw(p, static_cast<uint32_t> (b._thread));
+            p = raw(p, static_cast<unsigned long long> (std::chrono::duration_cast<std::chrono::nanoseconds>
+                                                         (std::chrono::system_clock::now().time_since_epoch()).count()));
+            p = raw(p, static_cast<uint32_t> (payload));
+            encode_all(p, args...);
+            if (start == b._data + b._size) {
+                b._size += size;
+            } else {
+                std::lock_guard<std::mutex> lock(_mutex);
+                put(start, size);
+            }
+        }
+
+        /*
+         * @function decode: turn a binary log read from @in into text lines on @os
+         * @return false if @in is not a binary log, ends in the middle of a record or holds
+         *         a record whose arguments do not add up
+         */
+        static bool decode(std::istream &in, std::ostream &os) {
+            char magic[8];
+            if (!in.read(magic, sizeof(magic)) || memcmp(magic, "ULOGBIN1", sizeof(magic)) != 0) {
+                return false;
+            }
+            struct site {
+                unsigned short _level;
+                unsigned _line;
+                std::string _file;
+                std::string _format;
+            };
+            std::map<unsigned, site> sites;
+            char kind;
+            while (in.get(kind)) {
+                uint32_t id = 0;
+                if (!in.read(reinterpret_cast<char*> (&id), sizeof(id))) {
+                    return false;
+                }
+                if (kind == 'D') {
+                    site s;
+                    uint16_t level = 0, length = 0;
+                    uint32_t line = 0;
+                    in.read(reinterpret_cast<char*> (&level), sizeof(level));
+                    in.read(reinterpret_cast<char*> (&line), sizeof(line));
+                    in.read(reinterpret_cast<char*> (&length), sizeof(length));
+                    s._file.resize(length);
+                    in.read(&s._file[0], length);
+                    in.read(reinterpret_cast<char*> (&length), sizeof(length));
+                    s._format.resize(length);
+                    in.read(&s._format[0], length);
+                    if (!in) {
+                        return false;
+                    }
+                    s._level = level;
+                    s._line = line;
+                    sites[id] = s;
+                } else if (kind == 'E') {
+                    uint32_t thread = 0, length = 0;
+                    unsigned long long ns = 0;
+                    in.read(reinterpret_cast<char*> (&thread), sizeof(thread));
+                    in.read(reinterpret_cast<char*> (&ns), sizeof(ns));
+                    in.read(reinterpret_cast<char*> (&length), sizeof(length));
+                    /*read by pieces, a corrupt length must not allocate gigabytes before failing*/
+                    std::string payload;
+                    while (in && payload.size() < length) {
+                        size_t start = payload.size();
+                        payload.resize(start + std::min<size_t> (length - start, capacity));
+                        in.read(&payload[start], payload.size() - start);
+                    }
+                    if (!in) {
+                        return false;
+                    }
+                    std::map<unsigned, site>::const_iterator s = sites.find(id);
+                    if (s == sites.end()) {
+                        os << "[unknown call site " << id << "]\n";
+                        continue;
+                    }
+                    std::time_t seconds = static_cast<std::time_t> (ns / 1000000000ULL);
+                    std::tm local;
+                    localtime_r(&seconds, &local);
+                    char stamp[64];
+                    size_t n = std::strftime(stamp, sizeof(stamp), "%a %F %H:%M:%S", &local);
+                    snprintf(stamp + n, sizeof(stamp) - n, ".%06u", static_cast<unsigned> (ns % 1000000000ULL / 1000));
+                    std::string text;
+                    if (!render(s->second._format, payload, text)) {
+                        return false;
+                    }
+                    os << '[' << stamp << ' ' << level_tag(s->second._level) << "] => " << text << '\n';
+                } else {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    private:
+        static char level_tag(unsigned short level) {
+            if ((level & 0x8000) == 0x8000) {
+                return 'D';
+            } else if ((level & 0x4000) == 0x4000) {
+                return 'I';
+            } else if ((level & 0x2000) == 0x2000) {
+                return 'W';
+            } else if ((level & 0x1000) == 0x1000) {
+                return 'E';
+            }
+            return 'F';
+        }
+
+        /*
+         * @function render: printf @format with arguments decoded from @payload into @out,
+         *                   conversions follow the recorded type rather than the length modifiers
+         * @return false if an argument runs past the end of @payload or has an unknown type
+         */
+        static bool render(const std::string &format, const std::string &payload, std::string &out) {
+            size_t at = 0;
+            for (size_t i = 0; i < format.size(); ++i) {
+                if (format[i] != '%') {
+                    out.push_back(format[i]);
+                    continue;
+                }
+                if (i + 1 < format.size() && format[i + 1] == '%') {
+                    out.push_back('%');
+                    ++i;
+                    continue;
+                }
+                std::string spec("%");
+                size_t j = i + 1;
+                while (j < format.size() && strchr("-+ #0", format[j]) != nullptr) {
+                    spec.push_back(format[j++]);
+                }
+                while (j < format.size() && (isdigit(static_cast<unsigned char> (format[j])) || format[j] == '.' || format[j] == '*')) {
+                    if (format[j] == '*') {
+                        long long width = 0;
+                        if (at < payload.size() && !next(payload, at, width)) {
+                            return false;
+                        }
+                        spec.append(std::to_string(width));
+                    } else {
+                        spec.push_back(format[j]);
+                    }
+                    ++j;
+                }
+                while (j < format.size() && strchr("hlLqjzt", format[j]) != nullptr) {
+                    ++j;
+                }
+                if (j >= format.size()) {
+                    break;
+                }
+                char conversion = format[j];
+                i = j;
+                if (at >= payload.size()) {
+                    out.append("<missing>");
+                    continue;
+                }
+                char tag = payload[at];
+                if (tag == 's') {
+                    uint32_t size = 0;
+                    if (payload.size() - at < 5) {
+                        return false;
+                    }
+                    memcpy(&size, payload.data() + at + 1, sizeof(size));
+                    if (payload.size() - at - 5 < size) {
+                        return false;
+                    }
+                    std::string value(payload, at + 5, size);
+                    at += 5 + size;
+                    print(out, spec + "s", value.c_str());
+                } else if (tag == 'c') {
+                    if (payload.size() - at < 2) {
+                        return false;
+                    }
+                    char value = payload[at + 1];
+                    at += 2;
+                    print(out, spec + (conversion == 'c' ? "c" : "d"), value);
+                } else if (strchr("eEfFgGaA", conversion) != nullptr || (tag == 'd' && strchr("diuxXoc", conversion) == nullptr)) {
+                    double value = 0;
+                    if (!next(payload, at, value)) {
+                        return false;
+                    }
+                    print(out, spec + (strchr("eEfFgGaA", conversion) != nullptr ? conversion : 'g'), value);
+                } else if (conversion == 'p') {
+                    unsigned long long value = 0;
+                    if (!next(payload, at, value)) {
+                        return false;
+                    }
+                    print(out, spec + "p", reinterpret_cast<void*> (static_cast<uintptr_t> (value)));
+                } else if (conversion == 'c') {
+                    long long value = 0;
+                    if (!next(payload, at, value)) {
+                        return false;
+                    }
+                    print(out, spec + "c", static_cast<int> (value));
+                } else if (strchr("uxXo", conversion) != nullptr || (tag != 'i' && conversion != 'd' && conversion != 'i')) {
+                    unsigned long long value = 0;
+                    if (!next(payload, at, value)) {
+                        return false;
+                    }
+                    print(out, spec + "ll" + (strchr("uxXo", conversion) != nullptr ? conversion : 'u'), value);
+                } else {
+                    long long value = 0;
+                    if (!next(payload, at, value)) {
+                        return false;
+                    }
+                    print(out, spec + "lld", value);
+                }
+            }
+            return true;
+        }
+
+        template <typename T>
+        static void print(std::string &out, const std::string &spec, T value) {
+            int size = snprintf(nullptr, 0, spec.c_str(), value);
+            if (size > 0) {
+                size_t start = out.size();
+                out.resize(start + size + 1);
+                snprintf(&out[start], size + 1, spec.c_str(), value);
+                out.resize(start + size);
+            }
+        }
+
+        /*
+         * @function next: read the numeric argument at @at as @value, whatever type it was
+         *                 recorded with (a string reads as 0)
+         * @return false if the argument runs past the end of @payload or has an unknown type
+         */
+        template <typename T>
+        static bool next(const std::string &payload, size_t &at, T &value) {
+            if (at >= payload.size()) {
+                return false;
+            }
+            char tag = payload[at];
+            const char *p = payload.data() + at + 1;
+            size_t left = payload.size() - at - 1;
+            if (tag == 'c') {
+                if (left < 1) {
+                    return false;
+                }
+                value = static_cast<T> (*p);
+                at += 2;
+                return true;
+            }
+            if (tag == 's') {
+                uint32_t size = 0;
+                if (left < sizeof(size)) {
+                    return false;
+                }
+                memcpy(&size, p, sizeof(size));
+                if (left - sizeof(size) < size) {
+                    return false;
+                }
+                value = 0;
+                at += 5 + size;
+                return true;
+            }
+            if ((tag != 'i' && tag != 'u' && tag != 'd' && tag != 'p') || left < 8) {
+                return false;
+            }
+            if (tag == 'i') {
+                long long v;
+                memcpy(&v, p, sizeof(v));
+                value = static_cast<T> (v);
+            } else if (tag == 'd') {
+                double v;
+                memcpy(&v, p, sizeof(v));
+                value = static_cast<T> (v);
+            } else {
+                unsigned long long v;
+                memcpy(&v, p, sizeof(v));
+                value = static_cast<T> (v);
+            }
+            at += 9;
+            return true;
+        }
+    };
 }
 
 
@@ -474,6 +474,7 @@ namespace u {
                 ret = rsync_walk(root, op, user_data, parent);
             } else {
                 u::ws::work_station ws(threads);
+                ws.capacity(threads * 1024); // do not queue the whole tree ahead of the workers
                 async_walk(ws, root, op, user_data, parent);
             }
             return ret;
@@ -17,6 +17,8 @@
 #include <algorithm>
 #include <sstream>
 #include <vector>
+#include <memory>
+#include <type_traits>
 #include "u-base.hpp"
 namespace u {
 
@@ -167,6 +169,24 @@ namespace u {
             return ret;
         }
 
+        /**
+        ** Function  -- clone a string from a given string into memory of an allocator
+        ** Parameters:
+        **           -- value: a string to be cloned
+        **           -- alloc: allocator of char, e.g. u::ws::arena_allocator<char>
+        ** Return    -- a copy of @value, release its size() + 1 chars to @alloc
+        ***/
+        template <typename Allocator>
+        static char * dup(const std::string &value, Allocator alloc) {
+            static_assert(std::is_same<typename Allocator::value_type, char>::value, "dup needs an allocator of char");
+            char *ret = NULL;
+            if (!value.empty()) {
+                ret = std::allocator_traits<Allocator>::allocate(alloc, value.size() + 1);
+                memcpy(ret, value.c_str(), value.size() + 1);
+            }
+            return ret;
+        }
+
         /**
         ** Function  -- free a string, if string is null, nothing will done
         ** Parameters:
@@ -423,15 +443,10 @@ namespace u {
             return true;
         }
 
-        static void claim(int expression, const char *format, ...) {
+        template <typename ...Args>
+        static void claim(int expression, const char *format, const Args &... args) {
             if (!expression) {
-                char *msg = NULL;
-                va_list arg_list;
-                va_start(arg_list, format);
-                msg = u::va_format(format, arg_list);
-                va_end(arg_list);
-                std::cout << msg << std::endl;
-                u::string::free(&msg);
+                std::cout << u::format_local(format, args...) << std::endl;
                 assert(expression);
             }
         }
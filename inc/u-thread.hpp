@@ -25,149 +25,2976 @@
 /*-lpthread options for g++*/
 
 #include <vector>
+#include <deque>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
 #include <cassert>
 #include <functional>
+#include <exception>
+#include <stdexcept>
+#include <type_traits>
+#include <algorithm>
+#include <iterator>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include "u-base.hpp"
 
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+/*coroutine support (task<T>, co_await on stations and futures) needs -std=c++20*/
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#include <optional>
+#define U_WS_COROUTINE 1
+#endif
+#endif
+
 namespace u {
 
     namespace ws {
 
-        class worker {
+        /*
+         * steal_deque: Chase-Lev work stealing deque of T pointers.
+         *              push/take are called by the owner only and work on the bottom,
+         *              steal may be called by any thread and works on the top.
+         *              (Le et al., "Correct and Efficient Work-Stealing for Weak Memory Models")
+         */
+        template <typename T>
+        class steal_deque {
         private:
-            std::mutex *_mutex;
-            std::condition_variable *_cv;
-            int *_num;
+            struct ring {
+                long _size;
+                std::atomic<T*> *_items;
 
-            template <class Func, class... Args>
-            void exec(Func func, Args &&... args) {
-                {
-                    std::unique_lock<std::mutex> lock(*_mutex);
-                    _cv->wait(lock, [this] {
-                        return (*_num) > 0;
-                    });
+                ring(long size) : _size(size), _items(new std::atomic<T*>[size]) {
                 }
-                --(*_num);
-                _cv->notify_one();
-                func(std::forward<Args>(args)...);
-                {
-                    std::lock_guard<std::mutex> lock(*_mutex);
-                    ++(*_num);
+
+                ~ring() {
+                    delete [] _items;
                 }
-                _cv->notify_one();
+
+                T *get(long i) const {
+                    return _items[i & (_size - 1)].load(std::memory_order_relaxed);
+                }
+
+                void put(long i, T *item) {
+                    _items[i & (_size - 1)].store(item, std::memory_order_relaxed);
+                }
+            };
+
+            std::atomic<long> _top;
+            std::atomic<long> _bottom;
+            std::atomic<ring*> _ring;
+            std::vector<ring*> _retired; // grown-out rings, thieves may still read them
+
+            steal_deque(const steal_deque &);
+            steal_deque &operator=(const steal_deque &);
+
+        public:
+
+            steal_deque(long size = 256) : _top(0), _bottom(0), _ring(new ring(size)) {
+                assert(size > 0 && (size & (size - 1)) == 0);
             }
 
-            template <class Instance, class Func, class... Args>
-            void exec_memfun(Instance &instance, Func func, Args &&... args) {
-                {
-                    std::unique_lock<std::mutex> lock(*_mutex);
-                    _cv->wait(lock, [this] {
-                        return (*_num) > 0;
-                    });
+            ~steal_deque() {
+                delete _ring.load();
+                for (size_t i = 0; i < _retired.size(); ++i) {
+                    delete _retired[i];
                 }
-                --(*_num);
-                _cv->notify_one();
-                (instance.*func)(std::forward<Args>(args)...);
-                {
-                    std::lock_guard<std::mutex> lock(*_mutex);
-                    ++(*_num);
+            }
+
+            void push(T *item) {
+                long b = _bottom.load(std::memory_order_relaxed);
+                long t = _top.load(std::memory_order_acquire);
+                ring *r = _ring.load(std::memory_order_relaxed);
+                if (b - t > r->_size - 1) {
+                    ring *bigger = new ring(r->_size * 2);
+                    for (long i = t; i < b; ++i) {
+                        bigger->put(i, r->get(i));
+                    }
+                    _retired.push_back(r);
+                    _ring.store(bigger, std::memory_order_release);
+                    r = bigger;
+                }
+                r->put(b, item);
+                _bottom.store(b + 1, std::memory_order_release);
+            }
+
+            T *take() {
+                long b = _bottom.load(std::memory_order_relaxed) - 1;
+                ring *r = _ring.load(std::memory_order_relaxed);
+                _bottom.store(b, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                long t = _top.load(std::memory_order_relaxed);
+                T *item = nullptr;
+                if (t <= b) {
+                    item = r->get(b);
+                    if (t == b) { // last item, race against thieves
+                        if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                            item = nullptr;
+                        }
+                        _bottom.store(b + 1, std::memory_order_relaxed);
+                    }
+                } else {
+                    _bottom.store(b + 1, std::memory_order_relaxed);
+                }
+                return item;
+            }
+
+            /*
+             * @function steal: take the oldest item
+             * @params
+             *   @retry set to true if the deque was not empty but another thread won the race
+             */
+            T *steal(bool &retry) {
+                retry = false;
+                long t = _top.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                long b = _bottom.load(std::memory_order_acquire);
+                T *item = nullptr;
+                if (t < b) {
+                    ring *r = _ring.load(std::memory_order_acquire);
+                    item = r->get(t);
+                    if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                        item = nullptr;
+                        retry = true;
+                    }
+                }
+                return item;
+            }
+
+            long size() const {
+                long b = _bottom.load(std::memory_order_relaxed);
+                long t = _top.load(std::memory_order_relaxed);
+                return b > t ? b - t : 0;
+            }
+        };
+
+#ifndef U_CACHE_LINE
+#define U_CACHE_LINE 64
+#endif
+
+        /*
+         * mpmc_queue: bounded lock-free multi-producer/multi-consumer ring buffer
+         *             (D. Vyukov). every cell carries a sequence number telling whether it
+         *             is ready to be written or read, so producers and consumers only
+         *             contend on their own index. @capacity is rounded up to a power of two
+         */
+        template <typename T>
+        class mpmc_queue {
+        private:
+            struct cell {
+                std::atomic<size_t> _sequence;
+                T _data;
+            };
+
+            char _pad0[U_CACHE_LINE];
+            cell *_cells;
+            size_t _mask;
+            char _pad1[U_CACHE_LINE - sizeof(cell*) - sizeof(size_t)];
+            std::atomic<size_t> _enqueue;
+            char _pad2[U_CACHE_LINE - sizeof(std::atomic<size_t>)];
+            std::atomic<size_t> _dequeue;
+            char _pad3[U_CACHE_LINE - sizeof(std::atomic<size_t>)];
+
+            mpmc_queue(const mpmc_queue &);
+            mpmc_queue &operator=(const mpmc_queue &);
+
+            /*claim the cell at the tail, nullptr if the queue is full*/
+            cell *claim(size_t &pos) {
+                pos = _enqueue.load(std::memory_order_relaxed);
+                while (true) {
+                    cell *c = &_cells[pos & _mask];
+                    size_t seq = c->_sequence.load(std::memory_order_acquire);
+                    long diff = static_cast<long> (seq) - static_cast<long> (pos);
+                    if (diff == 0) {
+                        if (_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                            return c;
+                        }
+                    } else if (diff < 0) {
+                        return nullptr;
+                    } else {
+                        pos = _enqueue.load(std::memory_order_relaxed);
+                    }
                 }
-                _cv->notify_one();
             }
 
         public:
 
-            worker(int *num, std::mutex *mutex, std::condition_variable *cv) {
-                _num = num;
-                _mutex = mutex;
-                _cv = cv;
+            mpmc_queue(size_t capacity) {
+                size_t size = 2;
+                while (size < capacity) {
+                    size <<= 1;
+                }
+                _mask = size - 1;
+                _cells = new cell[size];
+                for (size_t i = 0; i < size; ++i) {
+                    _cells[i]._sequence.store(i, std::memory_order_relaxed);
+                }
+                _enqueue.store(0, std::memory_order_relaxed);
+                _dequeue.store(0, std::memory_order_relaxed);
             }
 
-            template <class Func, class... Args>
-            void run(bool async, Func& func, Args &&... args) {
-                auto fun = std::bind(&worker::exec<Func, Args...>, this, func, args...);
-                std::thread thread(fun, func, args...);
-                if (async) {
-                    thread.detach();
-                } else {
-                    thread.join();
+            ~mpmc_queue() {
+                delete [] _cells;
+            }
+
+            /*
+             * @function push: append @value
+             * @return false if the queue is full, @value is left untouched then
+             */
+            bool push(const T &value) {
+                size_t pos = 0;
+                cell *c = claim(pos);
+                if (c != nullptr) {
+                    c->_data = value;
+                    c->_sequence.store(pos + 1, std::memory_order_release);
                 }
+                return c != nullptr;
             }
 
-            template <class Instance, class Func, class... Args>
-            void run_memfun(bool async, Instance &instance, Func func, Args &&... args) {
-                auto fun = std::bind(&worker::exec_memfun<Instance, Func, Args...>, this, instance, func, args...);
-                std::thread thread(fun, instance, func, args...);
-                if (async) {
-                    thread.detach();
-                } else {
-                    thread.join();
+            bool push(T &&value) {
+                size_t pos = 0;
+                cell *c = claim(pos);
+                if (c != nullptr) {
+                    c->_data = std::move(value);
+                    c->_sequence.store(pos + 1, std::memory_order_release);
+                }
+                return c != nullptr;
+            }
+
+            /*
+             * @function pop: move the oldest item to @value
+             * @return false if the queue is empty
+             */
+            bool pop(T &value) {
+                size_t pos = _dequeue.load(std::memory_order_relaxed);
+                while (true) {
+                    cell *c = &_cells[pos & _mask];
+                    size_t seq = c->_sequence.load(std::memory_order_acquire);
+                    long diff = static_cast<long> (seq) - static_cast<long> (pos + 1);
+                    if (diff == 0) {
+                        if (_dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                            value = std::move(c->_data);
+                            c->_sequence.store(pos + _mask + 1, std::memory_order_release);
+                            return true;
+                        }
+                    } else if (diff < 0) {
+                        return false;
+                    } else {
+                        pos = _dequeue.load(std::memory_order_relaxed);
+                    }
                 }
             }
+
+            size_t capacity() const {
+                return _mask + 1;
+            }
+
+            /*approximate number of items, exact only when no one is pushing or popping*/
+            size_t size() const {
+                size_t enqueue = _enqueue.load(std::memory_order_relaxed);
+                size_t dequeue = _dequeue.load(std::memory_order_relaxed);
+                return enqueue > dequeue ? enqueue - dequeue : 0;
+            }
+
+            bool empty() const {
+                return size() == 0;
+            }
         };
 
-        class work_station {
+        /*
+         * topology: cpus and NUMA nodes of the machine, read from sysfs (no libnuma)
+         */
+        class topology {
         private:
-            int _num;
-            std::mutex _mutex;
-            std::condition_variable _cv;
-            std::vector<std::pair<worker*, bool> > _workers;
+            static bool read(const std::string &filename, std::string &content) {
+                std::ifstream ifs(filename.c_str());
+                if (!ifs.fail()) {
+                    std::getline(ifs, content);
+                }
+                return !ifs.fail() && !content.empty();
+            }
 
         public:
 
-            work_station(int num) {
-                assert(num > 0);
-                _num = num;
-                for (int i = 0; i < num; ++i) {
-                    _workers.push_back(std::pair < worker*, bool>(new worker(&_num, &_mutex, &_cv), false));
+            /*
+             * @function parse: expand a sysfs cpu list such as "0-3,8,10-11"
+             */
+            static std::vector<int> parse(const std::string &list) {
+                std::vector<int> ret;
+                std::istringstream iss(list);
+                std::string range;
+                while (std::getline(iss, range, ',')) {
+                    int first = 0;
+                    int last = 0;
+                    char dash = 0;
+                    std::istringstream irange(range);
+                    if (irange >> first) {
+                        last = first;
+                        if (irange >> dash && dash == '-') {
+                            irange >> last;
+                        }
+                        for (int cpu = first; cpu <= last; ++cpu) {
+                            ret.push_back(cpu);
+                        }
+                    }
                 }
+                return ret;
             }
 
-            template <class Func, class...Args>
-            int run(Func& func, Args &&...args) {
-                int ret = 0;
-                {
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    _cv.wait(lock, [this] {
-                        return _num > 0;
-                    });
+            /*
+             * @function nodes: cpus of every NUMA node, indexed by node id. machines without
+             *                  NUMA information are reported as a single node
+             */
+            static const std::vector<std::vector<int> > &nodes() {
+                static const std::vector<std::vector<int> > ret = discover();
+                return ret;
+            }
+
+            static std::vector<std::vector<int> > discover() {
+                std::vector<std::vector<int> > ret;
+                std::string content;
+                if (read("/sys/devices/system/node/online", content)) {
+                    std::vector<int> ids = parse(content);
+                    for (size_t i = 0; i < ids.size(); ++i) {
+                        std::ostringstream name;
+                        name << "/sys/devices/system/node/node" << ids[i] << "/cpulist";
+                        std::string cpus;
+                        if (ids[i] >= 0 && read(name.str(), cpus)) {
+                            if (static_cast<size_t> (ids[i]) >= ret.size()) {
+                                ret.resize(ids[i] + 1);
+                            }
+                            ret[ids[i]] = parse(cpus);
+                        }
+                    }
                 }
-                for (int i = 0; i < _num; ++i) {
-                    if (!_workers[i].second) {
-                        _workers[i].second = true;
-                        _cv.notify_one();
-                        ret = i;
-                        break;
+                if (ret.empty()) {
+                    std::vector<int> cpus;
+                    if (read("/sys/devices/system/cpu/online", content)) {
+                        cpus = parse(content);
                     }
+                    if (cpus.empty()) {
+                        unsigned num = std::thread::hardware_concurrency();
+                        for (unsigned i = 0; i < (num == 0 ? 1 : num); ++i) {
+                            cpus.push_back(static_cast<int> (i));
+                        }
+                    }
+                    ret.push_back(cpus);
                 }
-                _workers[ret].first->run(true, func, args...);
                 return ret;
             }
 
-            template <class Instance, class Func, class...Args>
-            int run_memfun(Instance &instance, Func func, Args &&...args) {
-                int ret = 0;
-                {
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    _cv.wait(lock, [this] {
-                        return _num > 0;
-                    });
+            /*
+             * @function node_of: NUMA node of @cpu, 0 if unknown
+             */
+            static int node_of(int cpu) {
+                const std::vector<std::vector<int> > &all = nodes();
+                for (size_t i = 0; i < all.size(); ++i) {
+                    if (std::find(all[i].begin(), all[i].end(), cpu) != all[i].end()) {
+                        return static_cast<int> (i);
+                    }
                 }
-                for (int i = 0; i < _num; ++i) {
-                    if (!_workers[i].second) {
-                        _workers[i].second = true;
-                        _cv.notify_one();
-                        ret = i;
-                        break;
+                return 0;
+            }
+
+            /*
+             * @function current_node: NUMA node of the cpu running the calling thread
+             */
+            static int current_node() {
+#ifdef __linux__
+                int cpu = sched_getcpu();
+                return cpu < 0 ? 0 : node_of(cpu);
+#else
+                return 0;
+#endif
+            }
+        };
+
+        /*
+         * affinity: where the workers of a work_station may run. worker i takes the
+         *           (i % n)th of the n configured cpu sets, the default pins nothing
+         */
+        class affinity {
+        private:
+            std::vector<std::vector<int> > _cpus;
+            std::vector<int> _nodes;
+
+        public:
+
+            affinity() {
+            }
+
+            /*
+             * @function cores: pin worker i to core @cpus[i % @cpus.size()]
+             */
+            static affinity cores(const std::vector<int> &cpus) {
+                affinity ret;
+                for (size_t i = 0; i < cpus.size(); ++i) {
+                    ret._cpus.push_back(std::vector<int>(1, cpus[i]));
+                    ret._nodes.push_back(topology::node_of(cpus[i]));
+                }
+                return ret;
+            }
+
+            /*
+             * @function nodes: spread workers round-robin over NUMA nodes @ids (all nodes if
+             *                  empty), each worker may run on any cpu of its node
+             */
+            static affinity nodes(const std::vector<int> &ids = std::vector<int>()) {
+                affinity ret;
+                const std::vector<std::vector<int> > &all = topology::nodes();
+                for (size_t i = 0; i < (ids.empty() ? all.size() : ids.size()); ++i) {
+                    int id = ids.empty() ? static_cast<int> (i) : ids[i];
+                    assert(id >= 0 && static_cast<size_t> (id) < all.size());
+                    if (!all[id].empty()) {
+                        ret._cpus.push_back(all[id]);
+                        ret._nodes.push_back(id);
+                    }
+                }
+                return ret;
+            }
+
+            bool pinned() const {
+                return !_cpus.empty();
+            }
+
+            const std::vector<int> &cpus(int worker) const {
+                return _cpus[worker % _cpus.size()];
+            }
+
+            int node(int worker) const {
+                return pinned() ? _nodes[worker % _nodes.size()] : 0;
+            }
+
+            /*
+             * @function apply: restrict the calling thread to the cpus of @worker
+             */
+            bool apply(int worker) const {
+                bool ret = true;
+#ifdef __linux__
+                if (pinned()) {
+                    cpu_set_t set;
+                    CPU_ZERO(&set);
+                    const std::vector<int> &list = cpus(worker);
+                    for (size_t i = 0; i < list.size(); ++i) {
+                        CPU_SET(list[i], &set);
+                    }
+                    ret = (sched_setaffinity(0, sizeof(set), &set) == 0);
+                }
+#endif
+                return ret;
+            }
+        };
+
+        /*
+         * histogram: lock-free latency histogram with power-of-two nanosecond buckets,
+         *            bucket i counts values in [2^(i-1), 2^i)
+         */
+        class histogram {
+        public:
+            static const int BUCKETS = 64;
+
+            /*
+             * latency: plain copy of a histogram taken by snapshot()
+             */
+            struct latency {
+                std::vector<unsigned long long> _buckets;
+                unsigned long long _count;
+                unsigned long long _sum;
+
+                latency() : _buckets(BUCKETS, 0), _count(0), _sum(0) {
+                }
+
+                void merge(const latency &other) {
+                    for (int i = 0; i < BUCKETS; ++i) {
+                        _buckets[i] += other._buckets[i];
+                    }
+                    _count += other._count;
+                    _sum += other._sum;
+                }
+
+                double mean() const {
+                    return _count == 0 ? 0.0 : static_cast<double> (_sum) / _count;
+                }
+
+                /*upper bound in nanoseconds of the bucket holding percentile @p (0-100)*/
+                unsigned long long percentile(double p) const {
+                    unsigned long long rank = static_cast<unsigned long long> (p / 100.0 * _count);
+                    unsigned long long seen = 0;
+                    for (int i = 0; i < BUCKETS; ++i) {
+                        seen += _buckets[i];
+                        if (seen > rank || (seen == _count && _count != 0)) {
+                            return i == 0 ? 0 : (1ULL << (i < 63 ? i : 63));
+                        }
+                    }
+                    return 0;
+                }
+            };
+
+        private:
+            std::atomic<unsigned long long> _buckets[BUCKETS];
+            std::atomic<unsigned long long> _count;
+            std::atomic<unsigned long long> _sum;
+
+        public:
+
+            histogram() : _count(0), _sum(0) {
+                for (int i = 0; i < BUCKETS; ++i) {
+                    _buckets[i].store(0, std::memory_order_relaxed);
+                }
+            }
+
+            static int bucket(unsigned long long ns) {
+#ifdef __GNUC__
+                return ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+#else
+                int i = 0;
+                while (ns != 0) {
+                    ns >>= 1;
+                    ++i;
+                }
+                return i;
+#endif
+            }
+
+            void record(unsigned long long ns) {
+                _buckets[bucket(ns) < BUCKETS ? bucket(ns) : BUCKETS - 1].fetch_add(1, std::memory_order_relaxed);
+                _count.fetch_add(1, std::memory_order_relaxed);
+                _sum.fetch_add(ns, std::memory_order_relaxed);
+            }
+
+            latency snapshot() const {
+                latency ret;
+                for (int i = 0; i < BUCKETS; ++i) {
+                    ret._buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+                }
+                ret._count = _count.load(std::memory_order_relaxed);
+                ret._sum = _sum.load(std::memory_order_relaxed);
+                return ret;
+            }
+        };
+
+        /*nanoseconds on the monotonic clock*/
+        inline unsigned long long clock_ns() {
+            return static_cast<unsigned long long> (std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+
+        /*
+         * counters: telemetry of one worker, written by that worker only
+         */
+        struct counters {
+            std::atomic<unsigned long long> _executed;
+            std::atomic<unsigned long long> _steals;
+            std::atomic<unsigned long long> _idle; // nanoseconds spent sleeping
+            histogram _wait; // from submission to start
+            histogram _run;
+
+            counters() : _executed(0), _steals(0), _idle(0) {
+            }
+
+            void add(std::atomic<unsigned long long> &counter, unsigned long long value) {
+                counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+            }
+        };
+
+        struct worker_stats {
+            int _index;
+            int _node;
+            unsigned long long _executed;
+            unsigned long long _steals;
+            double _idle; // seconds
+            long _queued; // tasks in the deque of the worker
+        };
+
+        /*
+         * station_stats: snapshot of the telemetry of a work_station
+         */
+        struct station_stats {
+            std::vector<worker_stats> _workers;
+            long _pending; // queued tasks
+            long _busy;    // queued and running tasks
+            size_t _inbox; // tasks in the inboxes and their overflow
+            histogram::latency _wait;
+            histogram::latency _run;
+
+            void dump(std::ostream &os) const {
+                std::ios::fmtflags flags = os.flags();
+                std::streamsize precision = os.precision();
+                os << "[work_station] pending " << _pending << ", busy " << _busy << ", inbox " << _inbox << "\n";
+                for (size_t i = 0; i < _workers.size(); ++i) {
+                    const worker_stats &w = _workers[i];
+                    os << "  worker " << std::setw(3) << w._index << " node " << w._node << ": executed " << w._executed
+                       << ", steals " << w._steals << ", idle " << std::fixed << std::setprecision(3) << w._idle
+                       << "s, queued " << w._queued << "\n";
+                }
+                const histogram::latency *latencies[2] = {&_wait, &_run};
+                const char *names[2] = {"wait", "run"};
+                for (int i = 0; i < 2; ++i) {
+                    const histogram::latency &l = *latencies[i];
+                    os << "  " << names[i] << " (ns): count " << l._count << ", mean " << std::fixed << std::setprecision(0) << l.mean()
+                       << ", p50 " << l.percentile(50) << ", p90 " << l.percentile(90) << ", p99 " << l.percentile(99)
+                       << ", max " << l.percentile(100) << "\n";
+                }
+                os.flags(flags);
+                os.precision(precision);
+                os << std::flush;
+            }
+        };
+
+        /*
+         * arena: bump allocator handing out memory from large chunks, everything is freed at
+         *        once by reset(). every thread owns one, see current(); workers of a station
+         *        reset theirs each time an outermost task returns, so memory taken from it
+         *        inside a task must not outlive that task. u::string::dup and u::format
+         *        take an arena_allocator<char> to build their result here
+         */
+        class arena {
+        private:
+            struct chunk {
+                char *_data;
+                size_t _size;
+            };
+
+            size_t _chunk;
+            std::vector<chunk> _chunks;
+            size_t _index;  // chunk in use
+            size_t _offset; // first free byte in it
+            size_t _used;
+
+            arena(const arena &);
+            arena &operator=(const arena &);
+
+        public:
+
+            arena(size_t chunk_size = 64 * 1024) : _chunk(chunk_size), _index(0), _offset(0), _used(0) {
+            }
+
+            ~arena() {
+                for (size_t i = 0; i < _chunks.size(); ++i) {
+                    delete [] _chunks[i]._data;
+                }
+            }
+
+            /*
+             * @function current: arena of the calling thread
+             */
+            static arena &current() {
+                static thread_local arena local;
+                return local;
+            }
+
+            void *allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+                while (true) {
+                    if (_index < _chunks.size()) {
+                        chunk &c = _chunks[_index];
+                        size_t start = (reinterpret_cast<size_t> (c._data + _offset) + align - 1) & ~(align - 1);
+                        size_t end = start - reinterpret_cast<size_t> (c._data) + size;
+                        if (end <= c._size) {
+                            _used += end - _offset;
+                            _offset = end;
+                            return reinterpret_cast<void*> (start);
+                        }
+                        if (_index + 1 < _chunks.size()) {
+                            ++_index;
+                            _offset = 0;
+                            continue;
+                        }
+                    }
+                    chunk c;
+                    c._size = std::max(_chunk, size + align);
+                    c._data = new char[c._size];
+                    _chunks.push_back(c);
+                    _index = _chunks.size() - 1;
+                    _offset = 0;
+                }
+            }
+
+            /*
+             * @function reset: free everything at once. chunks of the default size are kept
+             *                  for reuse, oversized ones are given back
+             */
+            void reset() {
+                size_t kept = 0;
+                for (size_t i = 0; i < _chunks.size(); ++i) {
+                    if (_chunks[i]._size > _chunk) {
+                        delete [] _chunks[i]._data;
+                    } else {
+                        _chunks[kept++] = _chunks[i];
                     }
                 }
-                _workers[ret].first->run_memfun(true, instance, func, args...);
+                _chunks.resize(kept);
+                _index = 0;
+                _offset = 0;
+                _used = 0;
+            }
+
+            /*bytes handed out since the last reset*/
+            size_t used() const {
+                return _used;
+            }
+
+            /*
+             * @function dup: copy of @value in the arena, like u::string::dup but never freed
+             */
+            char *dup(const std::string &value) {
+                char *ret = nullptr;
+                if (!value.empty()) {
+                    ret = static_cast<char*> (allocate(value.size() + 1, 1));
+                    memcpy(ret, value.c_str(), value.size() + 1);
+                }
                 return ret;
             }
+
+            /*
+             * @function format: formatted string in the arena, like u::format but never freed
+             */
+            template <typename ...Args>
+            char *format(const char *format, const Args &... args);
+        };
+
+        /*
+         * arena_allocator: standard allocator drawing from an arena, the arena of the calling
+         *                  thread by default. deallocate is a no-op, memory goes back on reset
+         */
+        template <typename T>
+        class arena_allocator {
+        private:
+            arena *_arena;
+
+            template <typename U>
+            friend class arena_allocator;
+
+        public:
+            typedef T value_type;
+
+            arena_allocator() : _arena(&arena::current()) {
+            }
+
+            arena_allocator(arena &a) : _arena(&a) {
+            }
+
+            template <typename U>
+            arena_allocator(const arena_allocator<U> &other) : _arena(other._arena) {
+            }
+
+            T *allocate(size_t n) {
+                return static_cast<T*> (_arena->allocate(n * sizeof(T), alignof(T)));
+            }
+
+            void deallocate(T *, size_t) {
+            }
+
+            template <typename U>
+            struct rebind {
+                typedef arena_allocator<U> other;
+            };
+
+            template <typename U>
+            bool operator==(const arena_allocator<U> &other) const {
+                return _arena == other._arena;
+            }
+
+            template <typename U>
+            bool operator!=(const arena_allocator<U> &other) const {
+                return _arena != other._arena;
+            }
         };
+
+        template <typename ...Args>
+        char *arena::format(const char *format, const Args &... args) {
+            return u::format(arena_allocator<char>(*this), format, args...);
+        }
+
+        typedef std::basic_string<char, std::char_traits<char>, arena_allocator<char> > arena_string;
+
+        template <typename T>
+        using arena_vector = std::vector<T, arena_allocator<T> >;
+
+        class work_station;
+        class timer_wheel;
+
+        template <typename T>
+        class future;
+
+#ifdef U_WS_COROUTINE
+        struct schedule_awaiter;
+#endif
+
+        /*result type of calling @Func with @Args as std::bind would do*/
+        template <class Func, class...Args>
+        struct result_of {
+            typedef decltype(std::bind(std::declval<Func>(), std::declval<Args>()...)()) type;
+        };
+
+        struct job {
+            std::function<void()> _fn;
+            unsigned long long _queued; // submission time when telemetry is on
+
+            job(std::function<void()> &&fn) : _fn(std::move(fn)), _queued(0) {
+            }
+        };
+
+        /*
+         * station_worker: a long-lived thread owned by a work_station. tasks submitted from
+         *                 inside a worker go to its own deque, idle workers steal from the others.
+         */
+        class station_worker {
+        private:
+            int _index;
+            int _node;
+            work_station *_station;
+            steal_deque<job> _deque;
+            counters _counters;
+            int _depth; // nested task executions, the arena is reset when back to 0
+            std::thread _thread;
+
+            friend class work_station;
+
+        public:
+
+            template <class Station>
+            station_worker(Station *station, int index, int node) : _index(index), _node(node), _station(station), _deque(), _depth(0), _thread(&Station::serve, station, this) {
+            }
+
+            int index() const {
+                return _index;
+            }
+
+            int node() const {
+                return _node;
+            }
+
+            void join() {
+                if (_thread.joinable()) {
+                    _thread.join();
+                }
+            }
+        };
+
+        class work_station {
+        private:
+            int _num;
+            bool _started;
+            std::atomic<bool> _stop;
+            std::atomic<long> _pending; // tasks queued but not yet taken
+            std::atomic<long> _busy;    // tasks submitted but not yet finished
+            std::atomic<int> _sleepers;
+            std::mutex _mutex;
+            std::condition_variable _cv;
+            std::condition_variable _done;
+            affinity _affinity;
+            std::vector<mpmc_queue<job*>*> _inboxes; // per NUMA node, submissions from outside the station
+            std::deque<job*> _overflow;              // submissions that found every inbox full
+            std::atomic<long> _overflowed;           // size of @_overflow
+            std::mutex _overflow_mutex;
+            std::atomic<bool> _timing; // record wait/run latencies and idle time
+            std::thread _dumper;
+            std::mutex _dump_mutex;
+            std::condition_variable _dump_cv;
+            bool _dumping;
+            std::atomic<long> _capacity; // bound of queued tasks, 0 for none
+            std::atomic<int> _blocked;   // submitters waiting for room
+            std::mutex _space_mutex;
+            std::condition_variable _space;
+            std::vector<station_worker*> _workers;
+
+            friend class station_worker;
+            friend class timer_wheel;
+
+            static station_worker *&local() {
+                static thread_local station_worker *current = nullptr;
+                return current;
+            }
+
+            static unsigned random() {
+                static thread_local unsigned seed = static_cast<unsigned> (std::hash<std::thread::id>()(std::this_thread::get_id())) | 1u;
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                return seed;
+            }
+
+            /*pop from the inbox of @node first, then from the other nodes, then from the overflow*/
+            job *pop_inbox(int node) {
+                job *t = nullptr;
+                size_t size = _inboxes.size();
+                for (size_t i = 0; i < size && t == nullptr; ++i) {
+                    _inboxes[(node + i) % size]->pop(t);
+                }
+                if (t == nullptr && _overflowed.load() > 0) {
+                    std::lock_guard<std::mutex> lock(_overflow_mutex);
+                    if (!_overflow.empty()) {
+                        t = _overflow.front();
+                        _overflow.pop_front();
+                        _overflowed.fetch_sub(1);
+                    }
+                }
+                return t;
+            }
+
+            /*
+             * queue @t on the inbox of @node, or of another node when it is full. when every
+             * inbox is full, or older submissions already wait in the overflow, @t joins them
+             * there, so the submitter never blocks and never runs tasks of the station itself
+             */
+            void push_inbox(int node, job *t) {
+                size_t size = _inboxes.size();
+                if (_overflowed.load() == 0) {
+                    for (size_t i = 0; i < size; ++i) {
+                        if (_inboxes[(node + i) % size]->push(t)) {
+                            return;
+                        }
+                    }
+                }
+                std::lock_guard<std::mutex> lock(_overflow_mutex);
+                _overflow.push_back(t);
+                _overflowed.fetch_add(1);
+            }
+
+            /*steal from workers on the node of @self first, then from remote ones*/
+            job *steal(station_worker *self) {
+                job *t = nullptr;
+                bool retry = true;
+                while (t == nullptr && retry) {
+                    retry = false;
+                    unsigned start = random();
+                    for (int pass = 0; pass < 2 && t == nullptr; ++pass) {
+                        for (int i = 0; i < _num && t == nullptr; ++i) {
+                            station_worker *victim = _workers[(start + i) % _num];
+                            if (victim != self && (victim->_node == self->_node) == (pass == 0)) {
+                                bool contended = false;
+                                t = victim->_deque.steal(contended);
+                                retry = retry || contended;
+                            }
+                        }
+                    }
+                }
+                return t;
+            }
+
+            job *find(station_worker *self) {
+                job *t = self->_deque.take();
+                if (t == nullptr) {
+                    t = pop_inbox(self->_node);
+                }
+                if (t == nullptr) {
+                    t = steal(self);
+                    if (t != nullptr) {
+                        self->_counters.add(self->_counters._steals, 1);
+                    }
+                }
+                return t;
+            }
+
+            void execute(job *t, station_worker *self) {
+                _pending.fetch_sub(1);
+                if (_blocked.load() > 0) {
+                    std::lock_guard<std::mutex> lock(_space_mutex);
+                    _space.notify_all();
+                }
+                ++self->_depth;
+                if (_timing.load(std::memory_order_relaxed)) {
+                    unsigned long long start = clock_ns();
+                    t->_fn();
+                    unsigned long long end = clock_ns();
+                    counters &c = self->_counters;
+                    if (t->_queued != 0) {
+                        c._wait.record(start > t->_queued ? start - t->_queued : 0);
+                    }
+                    c._run.record(end - start);
+                } else {
+                    t->_fn();
+                }
+                self->_counters.add(self->_counters._executed, 1);
+                delete t;
+                if (--self->_depth == 0) {
+                    arena::current().reset();
+                }
+                if (_busy.fetch_sub(1) == 1) {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _done.notify_all();
+                    if (_stop.load()) {
+                        _cv.notify_all();
+                    }
+                }
+            }
+
+            void serve(station_worker *self) {
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _cv.wait(lock, [this] {
+                        return _started;
+                    });
+                }
+                local() = self;
+                _affinity.apply(self->_index);
+                while (true) {
+                    job *t = find(self);
+                    if (t != nullptr) {
+                        execute(t, self);
+                        continue;
+                    }
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _sleepers.fetch_add(1);
+                    unsigned long long asleep = _timing.load(std::memory_order_relaxed) ? clock_ns() : 0;
+                    while (_pending.load() <= 0 && !(_stop.load() && _busy.load() == 0)) {
+                        _cv.wait(lock);
+                    }
+                    if (asleep != 0) {
+                        self->_counters.add(self->_counters._idle, clock_ns() - asleep);
+                    }
+                    _sleepers.fetch_sub(1);
+                    if (_pending.load() <= 0 && _stop.load() && _busy.load() == 0) {
+                        break;
+                    }
+                }
+                local() = nullptr;
+            }
+
+            /*
+             * count one more queued task, honouring the capacity. when the station is full,
+             * @block false gives up at once, otherwise the caller waits until @deadline (if
+             * not null). workers of the station never wait, they run queued tasks instead and
+             * only go over the capacity when there is nothing they can run
+             */
+            bool admit(bool block, const std::chrono::steady_clock::time_point *deadline) {
+                while (true) {
+                    long capacity = _capacity.load(std::memory_order_relaxed);
+                    if (capacity <= 0) {
+                        _pending.fetch_add(1);
+                        return true;
+                    }
+                    long pending = _pending.load();
+                    while (pending < capacity) {
+                        if (_pending.compare_exchange_weak(pending, pending + 1)) {
+                            return true;
+                        }
+                    }
+                    if (!block) {
+                        return false;
+                    }
+                    if (current() >= 0) {
+                        if (!help()) {
+                            _pending.fetch_add(1);
+                            return true;
+                        }
+                        continue;
+                    }
+                    std::unique_lock<std::mutex> lock(_space_mutex);
+                    _blocked.fetch_add(1);
+                    bool expired = false;
+                    while (_pending.load() >= _capacity.load() && _capacity.load() > 0 && !expired) {
+                        if (deadline == nullptr) {
+                            _space.wait(lock);
+                        } else {
+                            expired = (_space.wait_until(lock, *deadline) == std::cv_status::timeout);
+                        }
+                    }
+                    _blocked.fetch_sub(1);
+                    if (expired && _pending.load() >= _capacity.load() && _capacity.load() > 0) {
+                        return false;
+                    }
+                }
+            }
+
+            /*queue @fn, already admitted, on the deque of the calling worker, or on the
+              inbox of @node (-1 for the node of the calling thread)*/
+            int place(std::function<void()> &&fn, int node = -1) {
+                job *t = new job(std::move(fn));
+                if (_timing.load(std::memory_order_relaxed)) {
+                    t->_queued = clock_ns();
+                }
+                int index = -1;
+                _busy.fetch_add(1);
+                station_worker *self = local();
+                if (node < 0 && self != nullptr && self->_station == this) {
+                    self->_deque.push(t);
+                    index = self->_index;
+                } else {
+                    if (_inboxes.size() == 1) {
+                        node = 0;
+                    } else if (node < 0) {
+                        node = topology::current_node();
+                    }
+                    push_inbox(node % static_cast<int> (_inboxes.size()), t);
+                }
+                if (_sleepers.load() > 0) {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _cv.notify_one();
+                }
+                return index;
+            }
+
+            int push(std::function<void()> &&fn, int node = -1) {
+                admit(true, nullptr);
+                return place(std::move(fn), node);
+            }
+
+            /*queue @fn past the capacity, for threads that must never wait (the timer ticker)*/
+            void post(std::function<void()> &&fn) {
+                _pending.fetch_add(1);
+                place(std::move(fn));
+            }
+
+            void start(int num, size_t inbox) {
+                assert(num > 0);
+                _num = num;
+                size_t nodes = _affinity.pinned() ? topology::nodes().size() : 1;
+                for (size_t i = 0; i < nodes; ++i) {
+                    _inboxes.push_back(new mpmc_queue<job*>(inbox));
+                }
+                for (int i = 0; i < num; ++i) {
+                    _workers.push_back(new station_worker(this, i, _affinity.node(i)));
+                }
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _started = true;
+                }
+                _cv.notify_all();
+            }
+
+        public:
+
+            /*
+             * @function work_station: start @num persistent worker threads
+             * @params
+             *   @inbox capacity of the queue taking submissions from outside the station,
+             *          when every inbox is full they wait in an unbounded overflow queue
+             */
+            work_station(int num, size_t inbox = 4096) : _started(false), _stop(false), _pending(0), _busy(0), _sleepers(0), _overflowed(0), _timing(false), _dumping(false), _capacity(0), _blocked(0) {
+                start(num, inbox);
+            }
+
+            /*
+             * @function work_station: start @num workers placed as @where says. with a
+             *                         pinned affinity every NUMA node gets its own inbox
+             */
+            work_station(int num, const affinity &where, size_t inbox = 4096) : _started(false), _stop(false), _pending(0), _busy(0), _sleepers(0), _affinity(where), _overflowed(0), _timing(false), _dumping(false), _capacity(0), _blocked(0) {
+                start(num, inbox);
+            }
+
+            /*
+             * @function ~work_station: run all pending tasks, then stop and join workers
+             */
+            ~work_station() {
+                dump_every(std::chrono::milliseconds(0), std::cout);
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _stop.store(true);
+                }
+                _cv.notify_all();
+                for (size_t i = 0; i < _workers.size(); ++i) {
+                    _workers[i]->join();
+                }
+                for (size_t i = 0; i < _workers.size(); ++i) {
+                    delete _workers[i];
+                }
+                _workers.clear();
+                for (size_t i = 0; i < _inboxes.size(); ++i) {
+                    delete _inboxes[i];
+                }
+                _inboxes.clear();
+                _overflow.clear();
+            }
+
+            int size() const {
+                return _num;
+            }
+
+            /*
+             * @function run: queue @func(@args...) to be executed by one of the workers.
+             *                @args are copied (as std::bind does), use std::ref to pass references.
+             *                tasks submitted from a worker stay on its own deque
+             * @return index of the worker whose deque received the task, -1 if it was
+             *         submitted from outside the station
+             */
+            template <class Func, class...Args>
+            int run(Func &&func, Args &&...args) {
+                return push(std::bind(std::forward<Func>(func), std::forward<Args>(args)...));
+            }
+
+            /*
+             * @function run_memfun: queue (@instance.*@func)(@args...), @instance is
+             *                       referenced, not copied, so it must outlive the task
+             */
+            template <class Instance, class Func, class...Args>
+            int run_memfun(Instance &instance, Func func, Args &&...args) {
+                return push(std::bind(func, &instance, std::forward<Args>(args)...));
+            }
+
+            /*
+             * @function try_run: like run, but give up when the station is at its capacity
+             * @return true if the task was queued
+             */
+            template <class Func, class...Args>
+            bool try_run(Func &&func, Args &&...args) {
+                bool ret = admit(false, nullptr);
+                if (ret) {
+                    place(std::bind(std::forward<Func>(func), std::forward<Args>(args)...));
+                }
+                return ret;
+            }
+
+            /*
+             * @function run_for: like run, but wait at most @timeout for room in the station
+             * @return true if the task was queued
+             */
+            template <class Rep, class Period, class Func, class...Args>
+            bool run_for(const std::chrono::duration<Rep, Period> &timeout, Func &&func, Args &&...args) {
+                std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+                bool ret = admit(true, &deadline);
+                if (ret) {
+                    place(std::bind(std::forward<Func>(func), std::forward<Args>(args)...));
+                }
+                return ret;
+            }
+
+            /*
+             * @function capacity: bound the number of queued (not yet started) tasks to
+             *                     @limit, 0 for no bound. when it is reached run and submit
+             *                     block outside the station, while workers of the station
+             *                     run queued tasks themselves until there is room
+             */
+            void capacity(size_t limit) {
+                _capacity.store(static_cast<long> (limit));
+                std::lock_guard<std::mutex> lock(_space_mutex);
+                _space.notify_all();
+            }
+
+            size_t capacity() const {
+                return static_cast<size_t> (_capacity.load());
+            }
+
+            /*
+             * @function run_on: queue @func(@args...) on the inbox of NUMA node @node, so
+             *                   that it is preferably picked up by workers of that node
+             */
+            template <class Func, class...Args>
+            int run_on(int node, Func &&func, Args &&...args) {
+                assert(node >= 0);
+                return push(std::bind(std::forward<Func>(func), std::forward<Args>(args)...), node);
+            }
+
+            /*
+             * @function submit: like run, but the result (or exception) of @func(@args...)
+             *                   is delivered through the returned future
+             */
+            template <class Func, class...Args>
+            future<typename result_of<Func, Args...>::type> submit(Func &&func, Args &&...args);
+
+            /*
+             * @function wait: block until every submitted task has finished,
+             *                 must not be called from a worker of this station
+             */
+            void wait() {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _done.wait(lock, [this] {
+                    return _busy.load() == 0;
+                });
+            }
+
+            /*
+             * @function telemetry: turn recording of task wait/run latencies and worker idle
+             *                     time on or off. task and steal counts are always kept
+             */
+            void telemetry(bool on) {
+                _timing.store(on);
+            }
+
+            /*
+             * @function stats: snapshot of the counters, queue depths and latencies
+             */
+            station_stats stats() const {
+                station_stats ret;
+                ret._pending = _pending.load();
+                ret._busy = _busy.load();
+                ret._inbox = 0;
+                for (size_t i = 0; i < _inboxes.size(); ++i) {
+                    ret._inbox += _inboxes[i]->size();
+                }
+                ret._inbox += _overflowed.load();
+                for (int i = 0; i < _num; ++i) {
+                    const counters &c = _workers[i]->_counters;
+                    worker_stats w;
+                    w._index = i;
+                    w._node = _workers[i]->_node;
+                    w._executed = c._executed.load(std::memory_order_relaxed);
+                    w._steals = c._steals.load(std::memory_order_relaxed);
+                    w._idle = c._idle.load(std::memory_order_relaxed) / 1e9;
+                    w._queued = _workers[i]->_deque.size();
+                    ret._wait.merge(c._wait.snapshot());
+                    ret._run.merge(c._run.snapshot());
+                    ret._workers.push_back(w);
+                }
+                return ret;
+            }
+
+            /*
+             * @function dump_every: write stats() to @os every @period from a background
+             *                      thread, a zero @period stops the dumping
+             */
+            void dump_every(std::chrono::milliseconds period, std::ostream &os) {
+                {
+                    std::lock_guard<std::mutex> lock(_dump_mutex);
+                    _dumping = false;
+                }
+                _dump_cv.notify_all();
+                if (_dumper.joinable()) {
+                    _dumper.join();
+                }
+                if (period.count() > 0) {
+                    _dumping = true;
+                    _dumper = std::thread([this, period, &os]() {
+                        std::unique_lock<std::mutex> lock(_dump_mutex);
+                        while (!_dump_cv.wait_for(lock, period, [this] {
+                            return !_dumping;
+                        })) {
+                            stats().dump(os);
+                        }
+                    });
+                }
+            }
+
+            /*
+             * @function running: station whose worker runs the calling thread, nullptr if none
+             */
+            static work_station *running() {
+                station_worker *self = local();
+                return self != nullptr ? self->_station : nullptr;
+            }
+
+#ifdef U_WS_COROUTINE
+            /*
+             * @function schedule: `co_await ws.schedule()` moves the coroutine onto a worker
+             */
+            schedule_awaiter schedule();
+#endif
+
+            /*
+             * @function current: index of the worker running the calling thread, -1 if
+             *                    the caller is not a worker of this station
+             */
+            int current() const {
+                station_worker *self = local();
+                return (self != nullptr && self->_station == this) ? self->_index : -1;
+            }
+
+            /*
+             * @function help: run one queued task on the calling worker thread, used to
+             *                 keep workers busy while they block on a result
+             * @return false if the caller is not a worker of this station or nothing was found
+             */
+            bool help() {
+                bool ret = false;
+                station_worker *self = local();
+                if (self != nullptr && self->_station == this) {
+                    job *t = find(self);
+                    if (t != nullptr) {
+                        execute(t, self);
+                        ret = true;
+                    }
+                }
+                return ret;
+            }
+        };
+
+        /*
+         * worker: runner of single calls from before work_station kept its threads, left for
+         *         code that drives it directly. a call still waits for one of the *@num free
+         *         slots, then runs on a work_station shared by all such workers (async) or on
+         *         the calling thread (not async) instead of on a thread of its own
+         */
+        class worker {
+        private:
+            int *_num;
+            std::mutex *_mutex;
+            std::condition_variable *_cv;
+
+            static work_station &station() {
+                static work_station shared(static_cast<int> (std::max(1u, std::thread::hardware_concurrency())));
+                return shared;
+            }
+
+            void acquire() {
+                std::unique_lock<std::mutex> lock(*_mutex);
+                _cv->wait(lock, [this] {
+                    return (*_num) > 0;
+                });
+                --(*_num);
+            }
+
+            void release() {
+                {
+                    std::lock_guard<std::mutex> lock(*_mutex);
+                    ++(*_num);
+                }
+                _cv->notify_one();
+            }
+
+            void dispatch(bool async, std::function<void()> &&call) {
+                acquire();
+                if (async) {
+                    station().run([this, call]() {
+                        call();
+                        release();
+                    });
+                } else {
+                    call();
+                    release();
+                }
+            }
+
+        public:
+
+            worker(int *num, std::mutex *mutex, std::condition_variable *cv) : _num(num), _mutex(mutex), _cv(cv) {
+            }
+
+            template <class Func, class... Args>
+            void run(bool async, Func &func, Args &&... args) {
+                dispatch(async, std::bind(func, std::forward<Args>(args)...));
+            }
+
+            template <class Instance, class Func, class... Args>
+            void run_memfun(bool async, Instance &instance, Func func, Args &&... args) {
+                dispatch(async, std::bind(func, &instance, std::forward<Args>(args)...));
+            }
+        };
+
+        /*
+         * future_value: storage of a future result, specialized for void
+         */
+        template <typename T>
+        class future_value {
+        private:
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type _storage;
+            bool _set;
+
+        public:
+            typedef T &reference;
+
+            future_value() : _set(false) {
+            }
+
+            ~future_value() {
+                if (_set) {
+                    reinterpret_cast<T*> (&_storage)->~T();
+                }
+            }
+
+            template <class Func>
+            void set_from(Func &func) {
+                new (&_storage) T(func());
+                _set = true;
+            }
+
+            reference get() {
+                return *reinterpret_cast<T*> (&_storage);
+            }
+        };
+
+        template <>
+        class future_value<void> {
+        public:
+            typedef void reference;
+
+            template <class Func>
+            void set_from(Func &func) {
+                func();
+            }
+
+            reference get() {
+            }
+        };
+
+        template <typename T>
+        struct future_state {
+            std::mutex _mutex;
+            std::condition_variable _cv;
+            bool _ready;
+            future_value<T> _value;
+            std::exception_ptr _error;
+            std::vector<std::function<void()> > _callbacks;
+            work_station *_station;
+
+            future_state(work_station *station) : _ready(false), _station(station) {
+            }
+
+            /*compute the value with @func, then wake waiters and fire callbacks*/
+            template <class Func>
+            void fulfil(Func &func) {
+                try {
+                    _value.set_from(func);
+                } catch (...) {
+                    _error = std::current_exception();
+                }
+                finish();
+            }
+
+            void fail(std::exception_ptr error) {
+                _error = error;
+                finish();
+            }
+
+            void finish() {
+                std::vector<std::function<void()> > callbacks;
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _ready = true;
+                    callbacks.swap(_callbacks);
+                }
+                _cv.notify_all();
+                for (size_t i = 0; i < callbacks.size(); ++i) {
+                    callbacks[i]();
+                }
+            }
+
+            /*run @callback on the fulfilling thread, or right now if already ready*/
+            void on_ready(std::function<void()> &&callback) {
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    if (!_ready) {
+                        _callbacks.push_back(std::move(callback));
+                        return;
+                    }
+                }
+                callback();
+            }
+
+            bool ready() {
+                std::lock_guard<std::mutex> lock(_mutex);
+                return _ready;
+            }
+        };
+
+        /*
+         * future: shared handle to the result of a task submitted to a work_station.
+         *         copies refer to the same result.
+         */
+        template <typename T>
+        class future {
+        private:
+            std::shared_ptr<future_state<T> > _state;
+
+            template <typename U>
+            friend class future;
+
+            /*call @func with the value of @state, void states pass nothing*/
+            template <class Func, typename U>
+            struct invoker {
+                typedef decltype(std::declval<Func>()(std::declval<U&>())) type;
+
+                static type call(Func &func, future_state<U> &state) {
+                    return func(state._value.get());
+                }
+            };
+
+            template <class Func>
+            struct invoker<Func, void> {
+                typedef decltype(std::declval<Func>()()) type;
+
+                static type call(Func &func, future_state<void> &) {
+                    return func();
+                }
+            };
+
+        public:
+
+            future() {
+            }
+
+            future(const std::shared_ptr<future_state<T> > &state) : _state(state) {
+            }
+
+            bool valid() const {
+                return _state != nullptr;
+            }
+
+            const std::shared_ptr<future_state<T> > &state() const {
+                return _state;
+            }
+
+            bool ready() const {
+                assert(valid());
+                return _state->ready();
+            }
+
+            /*
+             * @function wait: block until the result is available. on a worker of the
+             *                 owning station, queued tasks are run meanwhile instead; when
+             *                 there are none for a while the worker sleeps on the result,
+             *                 waking every millisecond to look for tasks again
+             */
+            void wait() const {
+                assert(valid());
+                work_station *station = _state->_station;
+                if (station != nullptr && station->current() >= 0) {
+                    int idle = 0;
+                    while (!_state->ready()) {
+                        if (station->help()) {
+                            idle = 0;
+                        } else if (++idle < 64) {
+                            std::this_thread::yield();
+                        } else {
+                            std::unique_lock<std::mutex> lock(_state->_mutex);
+                            _state->_cv.wait_for(lock, std::chrono::milliseconds(1), [this] {
+                                return _state->_ready;
+                            });
+                        }
+                    }
+                } else {
+                    std::unique_lock<std::mutex> lock(_state->_mutex);
+                    _state->_cv.wait(lock, [this] {
+                        return _state->_ready;
+                    });
+                }
+            }
+
+            /*
+             * @function get: wait for the result, rethrow the exception of the task if any
+             */
+            typename future_value<T>::reference get() const {
+                wait();
+                if (_state->_error) {
+                    std::rethrow_exception(_state->_error);
+                }
+                return _state->_value.get();
+            }
+
+            /*
+             * @function then: schedule @func(value) on the owning station once the result
+             *                 is ready (inline if there is no station). an exception of this
+             *                 future is forwarded to the returned one without calling @func
+             */
+            template <class Func>
+            future<typename invoker<Func, T>::type> then(Func func) const {
+                assert(valid());
+                typedef typename invoker<Func, T>::type R;
+                std::shared_ptr<future_state<T> > source = _state;
+                std::shared_ptr<future_state<R> > target(new future_state<R>(source->_station));
+                std::function<void()> next = [source, target, func]() mutable {
+                    if (source->_error) {
+                        target->fail(source->_error);
+                    } else {
+                        std::function<R()> call = [&]() -> R {
+                            return invoker<Func, T>::call(func, *source);
+                        };
+                        target->fulfil(call);
+                    }
+                };
+                work_station *station = source->_station;
+                source->on_ready([station, next]() {
+                    if (station != nullptr) {
+                        station->run(next);
+                    } else {
+                        next();
+                    }
+                });
+                return future<R>(target);
+            }
+        };
+
+        /*
+         * station of the first of @futures, nullptr for none. false if one of them has no
+         * state, the future of when_all then fails with std::invalid_argument
+         */
+        template <typename T>
+        bool when_all_station(const std::vector<future<T> > &futures, work_station *&station) {
+            station = nullptr;
+            for (size_t i = 0; i < futures.size(); ++i) {
+                if (!futures[i].valid()) {
+                    return false;
+                }
+            }
+            if (!futures.empty()) {
+                station = futures[0].state()->_station;
+            }
+            return true;
+        }
+
+        /*
+         * @function when_all: future of all the values of @futures, in the same order.
+         *                     the first exception met is forwarded instead. an empty
+         *                     @futures gives a ready future
+         */
+        template <typename T>
+        future<std::vector<T> > when_all(const std::vector<future<T> > &futures) {
+            work_station *station = nullptr;
+            bool valid = when_all_station(futures, station);
+            std::shared_ptr<future_state<std::vector<T> > > target(new future_state<std::vector<T> >(station));
+            if (!valid) {
+                target->fail(std::make_exception_ptr(std::invalid_argument("when_all: future without a state")));
+                return future<std::vector<T> >(target);
+            }
+            std::shared_ptr<std::atomic<size_t> > left(new std::atomic<size_t>(futures.size()));
+            std::vector<future<T> > sources(futures);
+            std::function<void()> done = [target, sources]() {
+                std::exception_ptr error;
+                for (size_t i = 0; i < sources.size() && !error; ++i) {
+                    error = sources[i].state()->_error;
+                }
+                if (error) {
+                    target->fail(error);
+                } else {
+                    std::function<std::vector<T>()> collect = [&sources]() {
+                        std::vector<T> values;
+                        values.reserve(sources.size());
+                        for (size_t i = 0; i < sources.size(); ++i) {
+                            values.push_back(sources[i].state()->_value.get());
+                        }
+                        return values;
+                    };
+                    target->fulfil(collect);
+                }
+            };
+            if (futures.empty()) {
+                done();
+            }
+            for (size_t i = 0; i < futures.size(); ++i) {
+                futures[i].state()->on_ready([left, done]() {
+                    if (left->fetch_sub(1) == 1) {
+                        done();
+                    }
+                });
+            }
+            return future<std::vector<T> >(target);
+        }
+
+        inline future<void> when_all(const std::vector<future<void> > &futures) {
+            work_station *station = nullptr;
+            bool valid = when_all_station(futures, station);
+            std::shared_ptr<future_state<void> > target(new future_state<void>(station));
+            if (!valid) {
+                target->fail(std::make_exception_ptr(std::invalid_argument("when_all: future without a state")));
+                return future<void>(target);
+            }
+            std::shared_ptr<std::atomic<size_t> > left(new std::atomic<size_t>(futures.size()));
+            std::vector<future<void> > sources(futures);
+            std::function<void()> done = [target, sources]() {
+                std::exception_ptr error;
+                for (size_t i = 0; i < sources.size() && !error; ++i) {
+                    error = sources[i].state()->_error;
+                }
+                if (error) {
+                    target->fail(error);
+                } else {
+                    target->finish();
+                }
+            };
+            if (futures.empty()) {
+                done();
+            }
+            for (size_t i = 0; i < futures.size(); ++i) {
+                futures[i].state()->on_ready([left, done]() {
+                    if (left->fetch_sub(1) == 1) {
+                        done();
+                    }
+                });
+            }
+            return future<void>(target);
+        }
+
+        /*
+         * task_graph: tasks with dependencies. once run on a work_station, every task is
+         *             launched as soon as all the tasks it depends on have finished.
+         *             the graph may be run several times, but not concurrently
+         */
+        class task_graph {
+        private:
+            struct node {
+                std::function<void()> _fn;
+                std::vector<size_t> _successors;
+                size_t _dependencies;
+                std::atomic<size_t> _waiting; // unfinished dependencies in the current run
+
+                node(std::function<void()> &&fn) : _fn(std::move(fn)), _dependencies(0), _waiting(0) {
+                }
+            };
+
+            struct execution {
+                std::shared_ptr<std::vector<std::unique_ptr<node> > > _nodes;
+                std::shared_ptr<future_state<void> > _state;
+                std::atomic<size_t> _left;
+                std::mutex _mutex;
+                std::exception_ptr _error;
+
+                execution(const std::shared_ptr<std::vector<std::unique_ptr<node> > > &nodes, work_station *station)
+                    : _nodes(nodes), _state(new future_state<void>(station)), _left(nodes->size()) {
+                }
+            };
+
+            std::shared_ptr<std::vector<std::unique_ptr<node> > > _nodes;
+            int _acyclic; // result of acyclic() since the last change, -1 when not checked yet
+
+            static void launch(work_station &ws, const std::shared_ptr<execution> &exec, size_t id) {
+                ws.run([&ws, exec, id]() {
+                    node &n = *(*exec->_nodes)[id];
+                    bool failed = false;
+                    {
+                        std::lock_guard<std::mutex> lock(exec->_mutex);
+                        failed = static_cast<bool> (exec->_error);
+                    }
+                    if (!failed) { // after a failure the remaining tasks are skipped
+                        try {
+                            n._fn();
+                        } catch (...) {
+                            std::lock_guard<std::mutex> lock(exec->_mutex);
+                            if (!exec->_error) {
+                                exec->_error = std::current_exception();
+                            }
+                        }
+                    }
+                    for (size_t i = 0; i < n._successors.size(); ++i) {
+                        size_t next = n._successors[i];
+                        if ((*exec->_nodes)[next]->_waiting.fetch_sub(1) == 1) {
+                            launch(ws, exec, next);
+                        }
+                    }
+                    if (exec->_left.fetch_sub(1) == 1) {
+                        if (exec->_error) {
+                            exec->_state->fail(exec->_error);
+                        } else {
+                            exec->_state->finish();
+                        }
+                    }
+                });
+            }
+
+            /*Kahn's algorithm, true if every task can be reached in dependency order*/
+            bool acyclic() const {
+                std::vector<size_t> waiting(_nodes->size());
+                std::vector<size_t> ready;
+                for (size_t i = 0; i < _nodes->size(); ++i) {
+                    waiting[i] = (*_nodes)[i]->_dependencies;
+                    if (waiting[i] == 0) {
+                        ready.push_back(i);
+                    }
+                }
+                size_t visited = 0;
+                while (!ready.empty()) {
+                    size_t id = ready.back();
+                    ready.pop_back();
+                    ++visited;
+                    const std::vector<size_t> &next = (*_nodes)[id]->_successors;
+                    for (size_t i = 0; i < next.size(); ++i) {
+                        if (--waiting[next[i]] == 0) {
+                            ready.push_back(next[i]);
+                        }
+                    }
+                }
+                return visited == _nodes->size();
+            }
+
+        public:
+
+            task_graph() : _nodes(new std::vector<std::unique_ptr<node> >()), _acyclic(1) {
+            }
+
+            /*
+             * @function add: add task @fn running after all tasks in @after
+             * @return id of the new task
+             */
+            size_t add(std::function<void()> fn, const std::vector<size_t> &after = std::vector<size_t>()) {
+                size_t id = _nodes->size();
+                _nodes->push_back(std::unique_ptr<node>(new node(std::move(fn))));
+                for (size_t i = 0; i < after.size(); ++i) {
+                    precede(after[i], id);
+                }
+                return id;
+            }
+
+            /*
+             * @function precede: make task @after wait for task @before
+             */
+            void precede(size_t before, size_t after) {
+                assert(before < _nodes->size() && after < _nodes->size() && before != after);
+                (*_nodes)[before]->_successors.push_back(after);
+                ++(*_nodes)[after]->_dependencies;
+                _acyclic = -1;
+            }
+
+            size_t size() const {
+                return _nodes->size();
+            }
+
+            /*
+             * @function run: launch the tasks without dependencies on @ws, the others follow
+             *                as their dependencies finish. if a task throws, the tasks not yet
+             *                started are skipped and the exception goes to the returned future.
+             *                a graph with a dependency cycle runs nothing, its future holds a
+             *                std::logic_error. the check is done once after each change
+             */
+            future<void> run(work_station &ws) {
+                if (_acyclic < 0) {
+                    _acyclic = acyclic() ? 1 : 0;
+                }
+                std::shared_ptr<execution> exec(new execution(_nodes, &ws));
+                if (_acyclic == 0) {
+                    exec->_state->fail(std::make_exception_ptr(std::logic_error("task_graph: dependency cycle")));
+                    return future<void>(exec->_state);
+                }
+                if (_nodes->empty()) {
+                    exec->_state->finish();
+                }
+                std::vector<size_t> roots;
+                for (size_t i = 0; i < _nodes->size(); ++i) {
+                    node &n = *(*_nodes)[i];
+                    n._waiting.store(n._dependencies);
+                    if (n._dependencies == 0) {
+                        roots.push_back(i);
+                    }
+                }
+                for (size_t i = 0; i < roots.size(); ++i) {
+                    launch(ws, exec, roots[i]);
+                }
+                return future<void>(exec->_state);
+            }
+        };
+
+        template <class Func, class...Args>
+        future<typename result_of<Func, Args...>::type> work_station::submit(Func &&func, Args &&...args) {
+            typedef typename result_of<Func, Args...>::type R;
+            std::shared_ptr<future_state<R> > state(new future_state<R>(this));
+            std::function<R()> call = std::bind(std::forward<Func>(func), std::forward<Args>(args)...);
+            push([state, call]() mutable {
+                state->fulfil(call);
+            });
+            return future<R>(state);
+        }
+
+        /*
+         * pipeline_core: untyped machinery of a pipeline. items carry a sequence number and
+         *                travel through the stages as tasks of the station, at most @_tokens
+         *                of them being in flight so memory stays bounded. tasks hold a
+         *                reference to the core, they may still be unwinding after run()
+         */
+        class pipeline_core : public std::enable_shared_from_this<pipeline_core> {
+        public:
+            typedef std::shared_ptr<void> value;
+
+            struct item {
+                size_t _seq;
+                value _value; // null once dropped by a filter
+            };
+
+            struct stage {
+                std::function<value(value&)> _fn;
+                size_t _parallel;
+                bool _ordered;
+                std::unique_ptr<mpmc_queue<item*> > _queue;
+                std::atomic<size_t> _active;
+                std::mutex _mutex; // ordered stages: reorder buffer
+                std::map<size_t, item*> _buffer;
+                size_t _next;
+                bool _draining;
+
+                stage(std::function<value(value&)> &&fn, size_t parallel, bool ordered)
+                    : _fn(std::move(fn)), _parallel(parallel), _ordered(ordered), _active(0), _next(0), _draining(false) {
+                }
+            };
+
+            work_station &_station;
+            size_t _tokens;
+            std::function<bool(value&)> _source;
+            std::vector<std::unique_ptr<stage> > _stages;
+            std::mutex _mutex;
+            std::condition_variable _cv;
+            size_t _flight;
+            std::exception_ptr _error;
+
+            pipeline_core(work_station &ws, std::function<bool(value&)> &&source, size_t tokens)
+                : _station(ws), _tokens(tokens == 0 ? static_cast<size_t> (ws.size()) * 4 : tokens), _source(std::move(source)), _flight(0) {
+            }
+
+            void fail() {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (!_error) {
+                    _error = std::current_exception();
+                }
+            }
+
+            /*run stage @k on @it, then hand it to the next stage*/
+            void process(size_t k, item *it) {
+                if (it->_value) {
+                    try {
+                        it->_value = _stages[k]->_fn(it->_value);
+                    } catch (...) {
+                        fail();
+                        it->_value.reset();
+                    }
+                }
+                enter(k + 1, it);
+            }
+
+            void enter(size_t k, item *it) {
+                if (k == _stages.size()) {
+                    delete it;
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    --_flight;
+                    _cv.notify_all();
+                } else if (_stages[k]->_ordered) {
+                    enter_ordered(k, it);
+                } else {
+                    while (!_stages[k]->_queue->push(it)) {
+                        std::this_thread::yield(); // cannot happen, the queue holds all tokens
+                    }
+                    pump(k);
+                }
+            }
+
+            /*
+             * start tasks for queued items of stage @k while it is under its parallelism.
+             * callers either pushed an item or decremented @_active just before; the fence
+             * orders that store before the load of the other variable, so of a push and the
+             * end of the last running task at least one sees the other and no item is left
+             */
+            void pump(size_t k) {
+                stage &st = *_stages[k];
+                while (true) {
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (st._queue->empty()) {
+                        return;
+                    }
+                    size_t active = st._active.load();
+                    if (active >= st._parallel) {
+                        return;
+                    }
+                    if (!st._active.compare_exchange_weak(active, active + 1)) {
+                        continue;
+                    }
+                    item *it = nullptr;
+                    if (!st._queue->pop(it)) {
+                        st._active.fetch_sub(1);
+                        continue;
+                    }
+                    std::shared_ptr<pipeline_core> self = shared_from_this();
+                    _station.run([self, k, it]() {
+                        self->process(k, it);
+                        self->_stages[k]->_active.fetch_sub(1);
+                        self->pump(k);
+                    });
+                }
+            }
+
+            /*items go through an ordered stage one at a time, in sequence order*/
+            void enter_ordered(size_t k, item *it) {
+                stage &st = *_stages[k];
+                std::unique_lock<std::mutex> lock(st._mutex);
+                st._buffer[it->_seq] = it;
+                if (st._draining) {
+                    return;
+                }
+                st._draining = true;
+                while (!st._buffer.empty() && st._buffer.begin()->first == st._next) {
+                    item *next = st._buffer.begin()->second;
+                    st._buffer.erase(st._buffer.begin());
+                    ++st._next;
+                    lock.unlock();
+                    process(k, next);
+                    lock.lock();
+                }
+                st._draining = false;
+            }
+
+            /*block until @done holds, running station tasks meanwhile on its workers*/
+            template <class Predicate>
+            void wait(Predicate done) {
+                if (_station.current() >= 0) {
+                    while (true) {
+                        {
+                            std::lock_guard<std::mutex> lock(_mutex);
+                            if (done()) {
+                                break;
+                            }
+                        }
+                        if (!_station.help()) {
+                            std::this_thread::yield();
+                        }
+                    }
+                } else {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _cv.wait(lock, done);
+                }
+            }
+
+            void run() {
+                for (size_t k = 0; k < _stages.size(); ++k) {
+                    _stages[k]->_queue.reset(new mpmc_queue<item*>(_tokens));
+                }
+                size_t seq = 0;
+                while (true) {
+                    wait([this]() {
+                        return _flight < _tokens;
+                    });
+                    value v;
+                    bool more = false;
+                    try {
+                        more = !_error && _source(v);
+                    } catch (...) {
+                        fail();
+                    }
+                    if (!more) {
+                        break;
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(_mutex);
+                        ++_flight;
+                    }
+                    item *it = new item();
+                    it->_seq = seq++;
+                    it->_value = v;
+                    enter(0, it);
+                }
+                wait([this]() {
+                    return _flight == 0;
+                });
+                if (_error) {
+                    std::rethrow_exception(_error);
+                }
+            }
+        };
+
+        /*
+         * pipeline: stream of T values read from a source and pushed through typed stages.
+         *           each stage runs on the work_station with its own parallelism, stages
+         *           are linked by bounded queues, and at most @tokens items are in flight.
+         *           example:
+         *               u::ws::pipeline<std::string>(ws, read_line)
+         *                   .then(parse, 4)
+         *                   .filter(valid)
+         *                   .sink(write);     // ordered, runs and blocks until done
+         */
+        template <typename T>
+        class pipeline {
+        private:
+            std::shared_ptr<pipeline_core> _core;
+
+            template <typename U>
+            friend class pipeline;
+
+            pipeline(const std::shared_ptr<pipeline_core> &core) : _core(core) {
+            }
+
+            static size_t width(const pipeline_core &core, size_t parallel) {
+                return parallel == 0 ? static_cast<size_t> (core._station.size()) : parallel;
+            }
+
+        public:
+
+            /*
+             * @function pipeline: @source(T &) fills the next value, returns false at the end.
+             *                     it is called serially from the thread calling sink()
+             * @params
+             *   @tokens items in flight at most, 0 for four per worker
+             */
+            template <class Source>
+            pipeline(work_station &ws, Source source, size_t tokens = 0) {
+                std::function<bool(pipeline_core::value&)> produce = [source](pipeline_core::value &v) mutable {
+                    std::shared_ptr<T> next(new T());
+                    bool ret = source(*next);
+                    if (ret) {
+                        v = next;
+                    }
+                    return ret;
+                };
+                _core.reset(new pipeline_core(ws, std::move(produce), tokens));
+            }
+
+            /*
+             * @function then: add a stage mapping every T to @func(T &)
+             * @params
+             *   @parallel items processed at the same time by this stage, 0 for one per worker
+             *   @ordered process items one at a time in source order
+             */
+            template <class Func>
+            pipeline<typename std::decay<decltype(std::declval<Func&>()(std::declval<T&>()))>::type> then(Func func, size_t parallel = 1, bool ordered = false) {
+                typedef typename std::decay<decltype(std::declval<Func&>()(std::declval<T&>()))>::type U;
+                std::function<pipeline_core::value(pipeline_core::value&)> fn = [func](pipeline_core::value &in) mutable {
+                    return pipeline_core::value(new U(func(*static_cast<T*> (in.get()))));
+                };
+                _core->_stages.push_back(std::unique_ptr<pipeline_core::stage>(new pipeline_core::stage(std::move(fn), width(*_core, parallel), ordered)));
+                return pipeline<U>(_core);
+            }
+
+            /*
+             * @function filter: add a stage dropping the items for which @pred(T &) is false
+             */
+            template <class Predicate>
+            pipeline<T> &filter(Predicate pred, size_t parallel = 1) {
+                std::function<pipeline_core::value(pipeline_core::value&)> fn = [pred](pipeline_core::value &in) mutable {
+                    return pred(*static_cast<T*> (in.get())) ? in : pipeline_core::value();
+                };
+                _core->_stages.push_back(std::unique_ptr<pipeline_core::stage>(new pipeline_core::stage(std::move(fn), width(*_core, parallel), false)));
+                return *this;
+            }
+
+            /*
+             * @function sink: add the final stage calling @func(T &), then run the pipeline
+             *                 and return once every item went through. the first exception
+             *                 thrown by a stage stops the source and is rethrown here
+             * @params
+             *   @ordered feed the items to @func one at a time in source order
+             *   @parallel for unordered sinks, items handled at the same time
+             */
+            template <class Func>
+            void sink(Func func, bool ordered = true, size_t parallel = 1) {
+                std::function<pipeline_core::value(pipeline_core::value&)> fn = [func](pipeline_core::value &in) mutable {
+                    func(*static_cast<T*> (in.get()));
+                    return pipeline_core::value();
+                };
+                _core->_stages.push_back(std::unique_ptr<pipeline_core::stage>(new pipeline_core::stage(std::move(fn), width(*_core, parallel), ordered)));
+                _core->run();
+            }
+        };
+
+        /*
+         * timer_wheel: delayed and periodic tasks for a work_station, kept in a hierarchical
+         *              timing wheel (Varghese & Lauck) of 4 levels with 256 slots each, so
+         *              adding, cancelling and expiring a timer costs O(1). a single ticker
+         *              thread sleeps until the next tick that has work (a timer expiring or
+         *              a higher level to cascade) and skips the empty ticks in between.
+         *              expired timers are queued on the station past its capacity, so a
+         *              full station never holds the ticker up
+         */
+        class timer_wheel {
+        public:
+            /*
+             * handle: identifies a timer for cancel(), stale once the timer is gone
+             */
+            struct handle {
+                size_t _index;
+                unsigned long _generation;
+            };
+
+        private:
+            static const int LEVELS = 4;
+            static const int BITS = 8;
+            static const size_t SLOTS = 1 << BITS;
+            static const size_t NONE = static_cast<size_t> (-1);
+
+            struct timer {
+                std::function<void()> _fn;
+                unsigned long long _expires; // tick
+                unsigned long long _period;  // ticks, 0 for one shot
+                unsigned long _generation;
+                size_t _prev;
+                size_t _next;
+                size_t *_head; // list holding the timer, null when free
+            };
+
+            work_station &_station;
+            std::chrono::steady_clock::duration _tick;
+            std::chrono::steady_clock::time_point _origin;
+            unsigned long long _now; // ticks processed so far, may lag the clock while nothing is due
+            std::vector<size_t> _slots; // LEVELS * SLOTS list heads
+            std::vector<timer> _timers;
+            std::vector<size_t> _free;
+            size_t _count;
+            bool _stop;
+            std::mutex _mutex;
+            std::condition_variable _cv;
+            std::thread _ticker;
+
+            void link(size_t id) {
+                timer &t = _timers[id];
+                unsigned long long delta = t._expires > _now ? t._expires - _now : 0;
+                int level = 0;
+                while (level < LEVELS - 1 && delta >= (1ULL << (BITS * (level + 1)))) {
+                    ++level;
+                }
+                if (level == LEVELS - 1 && delta >= (1ULL << (BITS * LEVELS))) {
+                    t._expires = _now + (1ULL << (BITS * LEVELS)) - 1; // clamp, re-checked on expiry
+                }
+                size_t *head = &_slots[level * SLOTS + ((t._expires >> (BITS * level)) & (SLOTS - 1))];
+                t._head = head;
+                t._prev = NONE;
+                t._next = *head;
+                if (*head != NONE) {
+                    _timers[*head]._prev = id;
+                }
+                *head = id;
+            }
+
+            void unlink(size_t id) {
+                timer &t = _timers[id];
+                if (t._prev != NONE) {
+                    _timers[t._prev]._next = t._next;
+                } else {
+                    *t._head = t._next;
+                }
+                if (t._next != NONE) {
+                    _timers[t._next]._prev = t._prev;
+                }
+                t._head = nullptr;
+            }
+
+            void release(size_t id) {
+                _timers[id]._fn = std::function<void()>();
+                ++_timers[id]._generation;
+                _free.push_back(id);
+                --_count;
+            }
+
+            /*advance one tick: cascade higher levels when lower ones wrap, then fire level 0*/
+            void advance(std::vector<std::function<void()> > &due) {
+                ++_now;
+                for (int level = 1; level < LEVELS; ++level) {
+                    if ((_now & ((1ULL << (BITS * level)) - 1)) != 0) {
+                        break;
+                    }
+                    size_t *head = &_slots[level * SLOTS + ((_now >> (BITS * level)) & (SLOTS - 1))];
+                    size_t id = *head;
+                    *head = NONE;
+                    while (id != NONE) {
+                        size_t next = _timers[id]._next;
+                        link(id);
+                        id = next;
+                    }
+                }
+                size_t *head = &_slots[_now & (SLOTS - 1)];
+                size_t id = *head;
+                *head = NONE;
+                while (id != NONE) {
+                    timer &t = _timers[id];
+                    size_t next = t._next;
+                    t._head = nullptr;
+                    if (t._expires > _now) { // clamped far timer, not due yet
+                        link(id);
+                    } else {
+                        due.push_back(t._fn);
+                        if (t._period != 0) {
+                            t._expires = _now + t._period;
+                            link(id);
+                        } else {
+                            release(id);
+                        }
+                    }
+                    id = next;
+                }
+            }
+
+            /*
+             * @function next_event: first tick after _now with work: a non-empty slot of level 0
+             *                      or the cascade of a non-empty slot of a higher level. a
+             *                      timer of level L sits in one of the next SLOTS periods of
+             *                      2^(BITS * L) ticks, so SLOTS slots of each level are enough
+             */
+            unsigned long long next_event() const {
+                unsigned long long ret = _now + (1ULL << (BITS * LEVELS));
+                for (int level = 0; level < LEVELS; ++level) {
+                    unsigned long long base = _now >> (BITS * level);
+                    for (size_t j = 1; j <= SLOTS; ++j) {
+                        unsigned long long at = (base + j) << (BITS * level);
+                        if (at >= ret) {
+                            break;
+                        }
+                        if (_slots[level * SLOTS + ((base + j) & (SLOTS - 1))] != NONE) {
+                            ret = at;
+                            break;
+                        }
+                    }
+                }
+                return ret;
+            }
+
+            unsigned long long clock_tick() const {
+                return static_cast<unsigned long long> ((std::chrono::steady_clock::now() - _origin) / _tick);
+            }
+
+            unsigned long long ticks(std::chrono::steady_clock::duration d) const {
+                unsigned long long n = static_cast<unsigned long long> ((d + _tick - std::chrono::steady_clock::duration(1)) / _tick);
+                return n == 0 ? 1 : n;
+            }
+
+            void tick_loop() {
+                std::unique_lock<std::mutex> lock(_mutex);
+                while (!_stop) {
+                    if (_count == 0) {
+                        _cv.wait(lock, [this] {
+                            return _stop || _count != 0;
+                        });
+                        continue;
+                    }
+                    std::chrono::steady_clock::time_point next = _origin + _tick * static_cast<long long> (next_event());
+                    if (_cv.wait_until(lock, next) != std::cv_status::timeout) {
+                        continue; // timer added or stopping, re-evaluate
+                    }
+                    unsigned long long target = clock_tick();
+                    std::vector<std::function<void()> > due;
+                    while (_now < target && _count != 0) {
+                        unsigned long long event = next_event();
+                        if (event > target) {
+                            break;
+                        }
+                        _now = event - 1; // the ticks in between have nothing to do
+                        advance(due);
+                    }
+                    if (_now < target && (_count == 0 || next_event() > target)) {
+                        _now = target;
+                    }
+                    lock.unlock();
+                    for (size_t i = 0; i < due.size(); ++i) {
+                        _station.post(std::move(due[i]));
+                    }
+                    lock.lock();
+                }
+            }
+
+            handle add(std::function<void()> &&fn, std::chrono::steady_clock::duration delay, std::chrono::steady_clock::duration period) {
+                handle ret;
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    /*the ticker skips empty ticks, so count the delay from the clock, not from _now*/
+                    unsigned long long current = clock_tick();
+                    if (_count == 0 && current > _now) {
+                        _now = current;
+                    }
+                    size_t id = 0;
+                    if (_free.empty()) {
+                        id = _timers.size();
+                        _timers.push_back(timer());
+                        _timers[id]._generation = 0;
+                    } else {
+                        id = _free.back();
+                        _free.pop_back();
+                    }
+                    timer &t = _timers[id];
+                    t._fn = std::move(fn);
+                    t._expires = std::max(_now, current + 1) + ticks(delay); // from the next tick boundary, never early
+                    t._period = period.count() > 0 ? ticks(period) : 0;
+                    link(id);
+                    ++_count;
+                    ret._index = id;
+                    ret._generation = t._generation;
+                }
+                _cv.notify_one();
+                return ret;
+            }
+
+            timer_wheel(const timer_wheel &);
+            timer_wheel &operator=(const timer_wheel &);
+
+        public:
+
+            /*
+             * @function timer_wheel: run expired timers on @ws, with a resolution of @tick
+             */
+            timer_wheel(work_station &ws, std::chrono::steady_clock::duration tick = std::chrono::milliseconds(1))
+                : _station(ws), _tick(tick), _origin(std::chrono::steady_clock::now()), _now(0), _slots(LEVELS * SLOTS, NONE), _count(0), _stop(false) {
+                assert(tick.count() > 0);
+                _ticker = std::thread(&timer_wheel::tick_loop, this);
+            }
+
+            /*
+             * @function ~timer_wheel: stop the ticker, timers not yet expired are dropped
+             */
+            ~timer_wheel() {
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _stop = true;
+                }
+                _cv.notify_all();
+                _ticker.join();
+            }
+
+            /*
+             * @function run_after: run @func(@args...) on the station once @delay has passed
+             */
+            template <class Rep, class Period, class Func, class...Args>
+            handle run_after(const std::chrono::duration<Rep, Period> &delay, Func &&func, Args &&...args) {
+                return add(std::bind(std::forward<Func>(func), std::forward<Args>(args)...), std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay), std::chrono::steady_clock::duration(0));
+            }
+
+            /*
+             * @function run_every: run @func(@args...) on the station every @period, the
+             *                     first time after one @period, until cancelled
+             */
+            template <class Rep, class Period, class Func, class...Args>
+            handle run_every(const std::chrono::duration<Rep, Period> &period, Func &&func, Args &&...args) {
+                std::chrono::steady_clock::duration every = std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+                assert(every.count() > 0);
+                return add(std::bind(std::forward<Func>(func), std::forward<Args>(args)...), every, every);
+            }
+
+            /*
+             * @function cancel: remove timer @h, runs already handed to the station still happen
+             * @return false if the timer had already expired or been cancelled
+             */
+            bool cancel(const handle &h) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                bool ret = h._index < _timers.size() && _timers[h._index]._generation == h._generation && _timers[h._index]._head != nullptr;
+                if (ret) {
+                    unlink(h._index);
+                    release(h._index);
+                }
+                return ret;
+            }
+
+            /*number of pending timers*/
+            size_t size() {
+                std::lock_guard<std::mutex> lock(_mutex);
+                return _count;
+            }
+        };
+
+#ifdef U_WS_COROUTINE
+        struct schedule_awaiter {
+            work_station &_station;
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) {
+                _station.run(handle);
+            }
+
+            void await_resume() const noexcept {
+            }
+        };
+
+        inline schedule_awaiter work_station::schedule() {
+            return schedule_awaiter{*this};
+        }
+
+        /*
+         * future_awaiter: `co_await future` suspends until the value is ready, then resumes
+         *                 on the station the coroutine was running on (the station of the
+         *                 future if it was not running on one, inline if there is none)
+         */
+        template <typename T>
+        struct future_awaiter {
+            future<T> _future;
+
+            bool await_ready() const {
+                return _future.ready();
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) {
+                work_station *home = work_station::running();
+                if (home == nullptr) {
+                    home = _future.state()->_station;
+                }
+                _future.state()->on_ready([home, handle]() {
+                    if (home != nullptr) {
+                        home->run(handle);
+                    } else {
+                        handle.resume();
+                    }
+                });
+            }
+
+            typename future_value<T>::reference await_resume() const {
+                return _future.get();
+            }
+        };
+
+        template <typename T>
+        future_awaiter<T> operator co_await(const future<T> &f) {
+            return future_awaiter<T>{f};
+        }
+
+        template <typename T = void>
+        class task;
+
+        struct promise_base {
+            std::coroutine_handle<> _continuation;
+            std::exception_ptr _error;
+
+            struct final_awaiter {
+                bool await_ready() const noexcept {
+                    return false;
+                }
+
+                template <class Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                    std::coroutine_handle<> next = handle.promise()._continuation;
+                    return next ? next : std::noop_coroutine();
+                }
+
+                void await_resume() const noexcept {
+                }
+            };
+
+            std::suspend_always initial_suspend() const noexcept {
+                return {};
+            }
+
+            final_awaiter final_suspend() const noexcept {
+                return {};
+            }
+
+            void unhandled_exception() {
+                _error = std::current_exception();
+            }
+        };
+
+        template <typename T>
+        struct task_promise : promise_base {
+            std::optional<T> _value;
+
+            task<T> get_return_object();
+
+            template <typename U>
+            void return_value(U &&value) {
+                _value.emplace(std::forward<U>(value));
+            }
+
+            T result() {
+                if (_error) {
+                    std::rethrow_exception(_error);
+                }
+                return std::move(*_value);
+            }
+        };
+
+        template <>
+        struct task_promise<void> : promise_base {
+            task<void> get_return_object();
+
+            void return_void() const noexcept {
+            }
+
+            void result() {
+                if (_error) {
+                    std::rethrow_exception(_error);
+                }
+            }
+        };
+
+        /*
+         * task: lazily started coroutine returning T. it runs when awaited, on the thread
+         *       of the awaiter, use spawn() to start it on a work_station instead
+         */
+        template <typename T>
+        class task {
+        public:
+            typedef task_promise<T> promise_type;
+
+        private:
+            std::coroutine_handle<promise_type> _handle;
+
+        public:
+
+            explicit task(std::coroutine_handle<promise_type> handle) : _handle(handle) {
+            }
+
+            task(task &&other) noexcept : _handle(other._handle) {
+                other._handle = nullptr;
+            }
+
+            task &operator=(task &&other) noexcept {
+                if (this != &other) {
+                    if (_handle) {
+                        _handle.destroy();
+                    }
+                    _handle = other._handle;
+                    other._handle = nullptr;
+                }
+                return *this;
+            }
+
+            task(const task &) = delete;
+            task &operator=(const task &) = delete;
+
+            ~task() {
+                if (_handle) {
+                    _handle.destroy();
+                }
+            }
+
+            bool done() const {
+                return !_handle || _handle.done();
+            }
+
+            auto operator co_await() && noexcept {
+                struct awaiter {
+                    std::coroutine_handle<promise_type> _handle;
+
+                    bool await_ready() const noexcept {
+                        return !_handle || _handle.done();
+                    }
+
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+                        _handle.promise()._continuation = continuation;
+                        return _handle;
+                    }
+
+                    T await_resume() {
+                        return _handle.promise().result();
+                    }
+                };
+                return awaiter{_handle};
+            }
+
+            auto operator co_await() & noexcept {
+                return std::move(*this).operator co_await();
+            }
+        };
+
+        template <typename T>
+        task<T> task_promise<T>::get_return_object() {
+            return task<T>(std::coroutine_handle<task_promise<T> >::from_promise(*this));
+        }
+
+        inline task<void> task_promise<void>::get_return_object() {
+            return task<void>(std::coroutine_handle<task_promise<void> >::from_promise(*this));
+        }
+
+        /*fire and forget coroutine used to drive a task into a future*/
+        struct detached {
+            struct promise_type {
+                detached get_return_object() const noexcept {
+                    return {};
+                }
+
+                std::suspend_never initial_suspend() const noexcept {
+                    return {};
+                }
+
+                std::suspend_never final_suspend() const noexcept {
+                    return {};
+                }
+
+                void return_void() const noexcept {
+                }
+
+                void unhandled_exception() const noexcept {
+                    std::terminate();
+                }
+            };
+        };
+
+        template <typename T>
+        detached drive(work_station *station, task<T> t, std::shared_ptr<future_state<T> > state) {
+            if (station != nullptr) {
+                co_await station->schedule();
+            }
+            try {
+                if constexpr (std::is_void<T>::value) {
+                    co_await std::move(t);
+                    state->finish();
+                } else {
+                    std::optional<T> value(co_await std::move(t));
+                    auto take = [&value]() {
+                        return std::move(*value);
+                    };
+                    state->fulfil(take);
+                }
+            } catch (...) {
+                state->fail(std::current_exception());
+            }
+        }
+
+        /*
+         * @function spawn: start @t on a worker of @ws
+         * @return future of the value of @t
+         */
+        template <typename T>
+        future<T> spawn(work_station &ws, task<T> t) {
+            std::shared_ptr<future_state<T> > state(new future_state<T>(&ws));
+            drive(&ws, std::move(t), state);
+            return future<T>(state);
+        }
+
+        /*
+         * @function sync_wait: run @t from a plain function and block until it is done
+         */
+        template <typename T>
+        T sync_wait(task<T> t) {
+            std::shared_ptr<future_state<T> > state(new future_state<T>(nullptr));
+            drive(static_cast<work_station*> (nullptr), std::move(t), state);
+            future<T> result(state);
+            if constexpr (std::is_void<T>::value) {
+                result.get();
+            } else {
+                return std::move(result.get());
+            }
+        }
+
+        /*
+         * @function read_file: read @filename on @io, a station reserved for blocking calls,
+         *                      `co_await read_file(io, name)` then resumes on the station of
+         *                      the awaiting coroutine so compute workers never block on disk
+         */
+        inline future<std::string> read_file(work_station &io, const std::string &filename) {
+            return io.submit([filename]() {
+                std::ifstream ifs(filename.c_str(), std::ifstream::in | std::ifstream::binary);
+                if (ifs.fail()) {
+                    throw std::ios_base::failure("cannot open " + filename);
+                }
+                std::ostringstream oss;
+                oss << ifs.rdbuf();
+                return oss.str();
+            });
+        }
+#endif
+
+        /*
+         * @function grain_size: number of items per chunk when @grain is 0, about four
+         *                       chunks per worker so that stealing can balance the load
+         */
+        inline size_t grain_size(const work_station &ws, size_t size, size_t grain = 0) {
+            if (grain == 0) {
+                grain = size / (static_cast<size_t> (ws.size()) * 4);
+            }
+            return grain == 0 ? 1 : grain;
+        }
+
+        /*
+         * @function for_chunks: call @func(begin, end) for consecutive chunks of [0, @size),
+         *                       the first chunk runs on the calling thread. returns once all
+         *                       chunks are done, rethrowing the first exception met
+         */
+        template <class Func>
+        void for_chunks(work_station &ws, size_t size, size_t grain, Func func) {
+            grain = grain_size(ws, size, grain);
+            std::vector<future<void> > chunks;
+            for (size_t begin = grain; begin < size; begin += grain) {
+                size_t end = std::min(size, begin + grain);
+                chunks.push_back(ws.submit([&func, begin, end]() {
+                    func(begin, end);
+                }));
+            }
+            std::exception_ptr error;
+            try {
+                func(static_cast<size_t> (0), std::min(size, grain));
+            } catch (...) {
+                error = std::current_exception();
+            }
+            for (size_t i = 0; i < chunks.size(); ++i) {
+                try {
+                    chunks[i].get();
+                } catch (...) {
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                }
+            }
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        /*
+         * @function parallel_for: call @func(i) for every i in [@first, @last)
+         * @params
+         *   @grain number of indices per task, 0 for automatic selection
+         */
+        template <class Func>
+        void parallel_for(work_station &ws, size_t first, size_t last, Func func, size_t grain = 0) {
+            if (first < last) {
+                for_chunks(ws, last - first, grain, [&func, first](size_t begin, size_t end) {
+                    for (size_t i = first + begin; i < first + end; ++i) {
+                        func(i);
+                    }
+                });
+            }
+        }
+
+        /*
+         * @function parallel_for_each: call @func(*it) for every it in [@first, @last),
+         *                              @Iterator must be random access
+         */
+        template <class Iterator, class Func>
+        void parallel_for_each(work_station &ws, Iterator first, Iterator last, Func func, size_t grain = 0) {
+            if (first < last) {
+                for_chunks(ws, static_cast<size_t> (last - first), grain, [&func, first](size_t begin, size_t end) {
+                    for (Iterator it = first + begin; it != first + end; ++it) {
+                        func(*it);
+                    }
+                });
+            }
+        }
+
+        /*
+         * @function parallel_transform: *(@out + i) = @func(*(@first + i)) for every item,
+         *                               @out must have room for (@last - @first) items
+         */
+        template <class Iterator, class OutIterator, class Func>
+        OutIterator parallel_transform(work_station &ws, Iterator first, Iterator last, OutIterator out, Func func, size_t grain = 0) {
+            size_t size = first < last ? static_cast<size_t> (last - first) : 0;
+            if (size > 0) {
+                for_chunks(ws, size, grain, [&func, first, out](size_t begin, size_t end) {
+                    std::transform(first + begin, first + end, out + begin, func);
+                });
+            }
+            return out + size;
+        }
+
+        /*
+         * @function parallel_reduce: fold [@first, @last) into @init with @op, which must be
+         *                            associative. chunks are combined in order, so @op needs
+         *                            not be commutative
+         */
+        template <class Iterator, typename T, class BinaryOp>
+        T parallel_reduce(work_station &ws, Iterator first, Iterator last, T init, BinaryOp op, size_t grain = 0) {
+            size_t size = first < last ? static_cast<size_t> (last - first) : 0;
+            if (size > 0) {
+                grain = grain_size(ws, size, grain);
+                std::vector<T> partial((size + grain - 1) / grain, init);
+                for_chunks(ws, size, grain, [&op, &partial, first, grain](size_t begin, size_t end) {
+                    T value = *(first + begin);
+                    for (Iterator it = first + begin + 1; it != first + end; ++it) {
+                        value = op(value, *it);
+                    }
+                    partial[begin / grain] = value;
+                });
+                for (size_t i = 0; i < partial.size(); ++i) {
+                    init = op(init, partial[i]);
+                }
+            }
+            return init;
+        }
+
+        template <class Iterator>
+        typename std::iterator_traits<Iterator>::value_type parallel_reduce(work_station &ws, Iterator first, Iterator last) {
+            typedef typename std::iterator_traits<Iterator>::value_type T;
+            return parallel_reduce(ws, first, last, T(), std::plus<T>());
+        }
+
+        /*
+         * @function parallel_sort: sort chunks in parallel with std::sort, then merge
+         *                          neighbouring runs pairwise in parallel rounds
+         */
+        template <class Iterator, class Compare>
+        void parallel_sort(work_station &ws, Iterator first, Iterator last, Compare comp, size_t grain = 0) {
+            size_t size = first < last ? static_cast<size_t> (last - first) : 0;
+            if (size < 2) {
+                return;
+            }
+            grain = grain_size(ws, size, grain);
+            for_chunks(ws, size, grain, [&comp, first](size_t begin, size_t end) {
+                std::sort(first + begin, first + end, comp);
+            });
+            for (size_t run = grain; run < size; run *= 2) {
+                size_t pairs = (size + 2 * run - 1) / (2 * run);
+                parallel_for(ws, 0, pairs, [&comp, first, size, run](size_t i) {
+                    size_t begin = i * 2 * run;
+                    size_t middle = std::min(size, begin + run);
+                    size_t end = std::min(size, begin + 2 * run);
+                    if (middle < end) {
+                        std::inplace_merge(first + begin, first + middle, first + end, comp);
+                    }
+                }, 1);
+            }
+        }
+
+        template <class Iterator>
+        void parallel_sort(work_station &ws, Iterator first, Iterator last) {
+            parallel_sort(ws, first, last, std::less<typename std::iterator_traits<Iterator>::value_type>());
+        }
     }
 }
 
@@ -5,6 +5,9 @@
 
 #include <ctime>
 #include <stack>
+#include <string>
+#include <cstring>
+#include <chrono>
 
 namespace u {
 
@@ -76,10 +79,53 @@ namespace u {
         static std::string now(const std::string &fmt="%a %F %H:%M:%S") {
             char now_time[100];
             std::time_t t = std::time(nullptr);
-            std::strftime(now_time, sizeof(now_time), fmt.c_str(), std::localtime(&t));
+            std::tm local;
+            localtime_r(&t, &local);
+            std::strftime(now_time, sizeof(now_time), fmt.c_str(), &local);
             return std::string(now_time);
         }
 
+        /*
+         * @function stamp: current local time formatted by @fmt, cached per thread so that
+         *                  strftime only runs when the second changes (or @fmt does)
+         * @params
+         *   @fmt strftime format
+         *   @precision digits of the fraction appended as ".xxx": 0, 3 (ms) or 6 (us)
+         * @return buffer owned by the calling thread, valid until its next call
+         */
+        static const char *stamp(const char *fmt = "%a %F %H:%M:%S", int precision = 0) {
+            static thread_local char buffer[128];
+            static thread_local char format[64] = {0};
+            static thread_local std::time_t second = -1;
+            static thread_local size_t length = 0;
+
+            long long us = std::chrono::duration_cast<std::chrono::microseconds>
+                (std::chrono::system_clock::now().time_since_epoch()).count();
+            std::time_t t = static_cast<std::time_t> (us / 1000000);
+            if (t != second || std::strncmp(format, fmt, sizeof(format)) != 0) {
+                std::tm local;
+                localtime_r(&t, &local);
+                length = std::strftime(buffer, sizeof(buffer) - 8, fmt, &local);
+                std::strncpy(format, fmt, sizeof(format) - 1);
+                second = t;
+            }
+            char *p = buffer + length;
+            if (precision == 3 || precision == 6) {
+                int fraction = static_cast<int> (us % 1000000);
+                if (precision == 3) {
+                    fraction /= 1000;
+                }
+                *p++ = '.';
+                for (int i = precision - 1; i >= 0; --i) {
+                    p[i] = static_cast<char> ('0' + fraction % 10);
+                    fraction /= 10;
+                }
+                p += precision;
+            }
+            *p = '\0';
+            return buffer;
+        }
+
         static std::string today() {
             return now("%F");
         }
@@ -0,0 +1,99 @@
+/***
+  u-format-test.cpp checks of u::format_to against snprintf
+  Copyright (C) 2013  Renweu Gao
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ***/
+
+/*
+ * build: g++ -std=c++11 -g -fsanitize=address,undefined -I.. u-format-test.cpp -o u-format-test
+ * usage: u-format-test (exit status is the number of failed checks)
+ */
+
+#include "u-base"
+#include <climits>
+#include <cstdio>
+#include <string>
+
+namespace {
+
+    int failed = 0;
+
+    void check(const char *what, const std::string &got, const std::string &expected) {
+        if (got != expected) {
+            fprintf(stderr, "FAIL %s: got \"%s\", expected \"%s\"\n", what, got.c_str(), expected.c_str());
+            ++failed;
+        }
+    }
+
+    template <typename ...Args>
+    std::string format(const char *format, const Args &... args) {
+        char buffer[256];
+        u::format_to(buffer, sizeof(buffer), format, args...);
+        return buffer;
+    }
+
+    template <typename ...Args>
+    std::string printf_like(const char *format, const Args &... args) {
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer), format, args...);
+        return buffer;
+    }
+}
+
+int main() {
+    /*integers keep the width of their own type*/
+    check("%x of int -1", format("%x", -1), printf_like("%x", -1));
+    check("%X of int INT_MIN", format("%X", INT_MIN), printf_like("%X", INT_MIN));
+    check("%u of int -2", format("%u", -2), printf_like("%u", -2));
+    check("%o of short -1", format("%o", static_cast<short> (-1)), printf_like("%o", static_cast<short> (-1)));
+    check("%x of char -1", format("%x", static_cast<signed char> (-1)), printf_like("%x", static_cast<signed char> (-1)));
+    check("%x of long long -1", format("%x", -1LL), printf_like("%llx", -1LL));
+    check("%d of unsigned UINT_MAX", format("%d", UINT_MAX), printf_like("%u", UINT_MAX));
+    check("%d of int INT_MIN", format("%d", INT_MIN), printf_like("%d", INT_MIN));
+    check("%hhd of int -1", format("%hhd", -1), printf_like("%hhd", -1));
+    check("%hhd of int 300", format("%hhd", 300), printf_like("%hhd", 300));
+    check("%hhx of int -1", format("%hhx", -1), printf_like("%hhx", -1));
+    check("%hd of unsigned 65535", format("%hd", 65535U), printf_like("%hd", 65535U));
+    check("%hu of int -1", format("%hu", -1), printf_like("%hu", -1));
+    check("%lx of long -1", format("%lx", -1L), printf_like("%lx", -1L));
+    check("%08.3x|%-6d|", format("%08.3x|%-6d|", 255, -7), printf_like("%08.3x|%-6d|", 255, -7));
+    check("%*d", format("%*d", 6, 42), printf_like("%*d", 6, 42));
+
+    /*specifications longer than the internal buffer are copied, not overflowed*/
+    check("long flags and width", format("%-+ #0-+123456789012.*d|%d", INT_MIN, INT_MIN, 5),
+          "%-+ #0-+123456789012.*d|5");
+    check("long precision", format("%.123456789012345678901234567890d|%s", 1, "next"),
+          "%.123456789012345678901234567890d|next");
+    check("long width", format("%1234567890123456789012345678x", 1), "%1234567890123456789012345678x");
+    check("longest accepted", format("%-+ #01234567890.1234567890d", 7),
+          printf_like("%-+ #01234567890.1234567890d", 7).substr(0, 255));
+
+    /*an argument the conversion does not fit is marked, not reinterpreted*/
+    check("%d of a string", format("%d|%s", "text", "next"), "<bad arg>|next");
+    check("%x of a pointer", format("%x", static_cast<void *> (NULL)), "<bad arg>");
+    check("%f of an int", format("%f", 3), "<bad arg>");
+    check("%d of a double", format("%d", 2.5), "<bad arg>");
+    check("%c of a string", format("%c", "c"), "<bad arg>");
+    check("%s of numbers", format("%s %s %s", -3, 7U, 2.5), "-3 7 2.5");
+    check("missing argument", format("%d and %s", 1), "1 and <missing arg>");
+
+    /*a result of format_local may be formatted again by format_local*/
+    const char *inner = u::format_local("inner %d", 1);
+    check("format_local of its own result", u::format_local("[%s] [%s]", inner, inner), "[inner 1] [inner 1]");
+    std::string wide(2000, 'w');
+    const char *large = u::format_local("%s", wide);
+    check("format_local of its own large result", u::format_local("%s.", large), wide + ".");
+    return failed;
+}
@@ -0,0 +1,127 @@
+/***
+  u-log-async-test.cpp checks that the asynchronous mode of u::log loses nothing it does not report
+  Copyright (C) 2013  Renweu Gao
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ***/
+
+/*
+ * build: g++ -std=c++11 -g -fsanitize=thread -I.. u-log-async-test.cpp -o u-log-async-test -lpthread
+ * usage: u-log-async-test [directory for the logs] (exit status is the number of failed checks)
+ */
+
+#include "u-log"
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    int failed = 0;
+
+    void check(const std::string &what, long long got, long long expected) {
+        if (got != expected) {
+            fprintf(stderr, "FAIL %s: got %lld, expected %lld\n", what.c_str(), got, expected);
+            ++failed;
+        }
+    }
+
+    void burst(int threads, int count) {
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.push_back(std::thread([t, count]() {
+                for (int i = 0; i < count; ++i) {
+                    u::log::info("async thread %d line %d", t, i);
+                }
+            }));
+        }
+        for (size_t t = 0; t < workers.size(); ++t) {
+            workers[t].join();
+        }
+    }
+
+    /*what a log file holds: lines of every thread, whether each thread's lines are in order, drop reports*/
+    struct content {
+        long long _lines;
+        long long _misordered;
+        long long _reported;
+
+        content(const std::string &path, int threads) : _lines(0), _misordered(0), _reported(0) {
+            std::vector<int> last(threads, -1);
+            std::ifstream in(path.c_str());
+            std::string line;
+            while (std::getline(in, line)) {
+                int t = -1;
+                int i = -1;
+                unsigned long long lost = 0;
+                size_t at = line.find("async thread ");
+                if (at != std::string::npos && sscanf(line.c_str() + at, "async thread %d line %d", &t, &i) == 2 && t >= 0 && t < threads) {
+                    ++_lines;
+                    _misordered += (i <= last[t]) ? 1 : 0;
+                    last[t] = i;
+                } else if ((at = line.find("[log] ")) != std::string::npos && sscanf(line.c_str() + at, "[log] %llu messages dropped", &lost) == 1) {
+                    _reported += static_cast<long long> (lost);
+                }
+            }
+        }
+    };
+}
+
+int main(int argc, char *argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp";
+    std::string path = dir + "/u-log-async.log";
+    const std::ios_base::openmode trunc = std::ofstream::out | std::ofstream::trunc;
+    const int threads = 4;
+    const int count = 20000;
+
+    /*block: a small ring holds callers up, every line arrives once and in order per thread*/
+    u::log::open(u::F | 0x7F00, 0, ' ', path, trunc);
+    u::log::async(64, u::log_backend::block);
+    burst(threads, count);
+    u::log::flush();
+    content flushed(path, threads);
+    check("block lines after flush", flushed._lines, threads * count);
+    check("block dropped", static_cast<long long> (u::log::dropped()), 0);
+    u::log::sync();
+    u::log::open(u::T | 0x7F00);
+    content blocked(path, threads);
+    check("block lines", blocked._lines, threads * count);
+    check("block misordered", blocked._misordered, 0);
+
+    /*count: what does not fit is dropped, counted and reported in the log*/
+    u::log::open(u::F | 0x7F00, 0, ' ', path, trunc);
+    u::log::async(4, u::log_backend::count);
+    burst(threads, count);
+    long long dropped = static_cast<long long> (u::log::dropped());
+    u::log::sync();
+    u::log::open(u::T | 0x7F00);
+    content counted(path, threads);
+    check("count lines and drops", counted._lines + dropped, threads * count);
+    check("count reported", counted._reported, dropped);
+    check("count misordered", counted._misordered, 0);
+
+    /*drop: the same without reports*/
+    u::log::open(u::F | 0x7F00, 0, ' ', path, trunc);
+    u::log::async(4, u::log_backend::drop);
+    burst(threads, count);
+    dropped = static_cast<long long> (u::log::dropped());
+    u::log::sync();
+    u::log::open(u::T | 0x7F00);
+    content quiet(path, threads);
+    check("drop lines and drops", quiet._lines + dropped, threads * count);
+    check("drop reported", quiet._reported, 0);
+    return failed;
+}
@@ -0,0 +1,101 @@
+/***
+  u-log-crash-test.cpp checks that u::log::guard saves buffered lines on a fatal signal
+  Copyright (C) 2013  Renweu Gao
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ***/
+
+/*
+ * build: g++ -std=c++11 -g -I.. u-log-crash-test.cpp -o u-log-crash-test -lpthread
+ * usage: u-log-crash-test [directory for the logs] (exit status is the number of failed checks)
+ */
+
+#include "u-log"
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+
+namespace {
+
+    int failed = 0;
+
+    void check(const std::string &what, long long got, long long expected) {
+        if (got != expected) {
+            fprintf(stderr, "FAIL %s: got %lld, expected %lld\n", what.c_str(), got, expected);
+            ++failed;
+        }
+    }
+
+    long long lines(const std::string &path, const std::string &tag) {
+        std::ifstream in(path.c_str());
+        std::string line;
+        long long ret = 0;
+        while (std::getline(in, line)) {
+            if (line.find(tag) != std::string::npos) {
+                ++ret;
+            }
+        }
+        return ret;
+    }
+
+    /*
+     * log from two threads in a child process which then aborts: 's' writes directly,
+     * 'b' holds lines in the per-thread stage, 'a' queues them for the async writer and
+     * 'm' does the same into a mapped file
+     */
+    int crash(const std::string &path, char mode, int count) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            u::log::open(u::F | 0x7F00 | (mode == 'm' ? u::MMAP : 0), 0, ' ', path, std::ofstream::out | std::ofstream::trunc);
+            if (mode == 'a' || mode == 'm') {
+                u::log::async(1 << 12);
+            } else if (mode == 'b') {
+                u::log::buffer(1 << 20);
+            }
+            u::log::guard();
+            std::thread other([count]() {
+                for (int i = 0; i < count; ++i) {
+                    u::log::info("crash other %d", i);
+                }
+            });
+            for (int i = 0; i < count; ++i) {
+                u::log::info("crash main %d", i);
+            }
+            other.join();
+            abort();
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        return WIFSIGNALED(status) ? WTERMSIG(status) : -1;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp";
+    std::string path = dir + "/u-log-crash.log";
+    const int count = 2000;
+    const char modes[] = "sbam";
+    for (int i = 0; modes[i] != '\0'; ++i) {
+        std::string mode(1, modes[i]);
+        for (int run = 0; run < 5; ++run) {
+            check(mode + " died of SIGABRT", crash(path, modes[i], count), SIGABRT);
+            check(mode + " main lines", lines(path, "crash main "), count);
+            check(mode + " other lines", lines(path, "crash other "), count);
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,124 @@
+/***
+  u-log-limit-test.cpp checks sampling and rate limiting of log call sites
+  Copyright (C) 2013  Renweu Gao
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ***/
+
+/*
+ * build: g++ -std=c++11 -g -I.. u-log-limit-test.cpp -o u-log-limit-test -lpthread
+ * usage: u-log-limit-test [directory for the logs] (exit status is the number of failed checks)
+ */
+
+#include "u-log"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    int failed = 0;
+
+    void check(const std::string &what, long long got, long long expected) {
+        if (got != expected) {
+            fprintf(stderr, "FAIL %s: got %lld, expected %lld\n", what.c_str(), got, expected);
+            ++failed;
+        }
+    }
+
+    /*lines of @path holding @tag, and the sum of the K of "suppressed K messages" lines*/
+    long long lines(const std::string &path, const std::string &tag, long long *suppressed = nullptr) {
+        std::ifstream in(path.c_str());
+        std::string line;
+        long long ret = 0;
+        while (std::getline(in, line)) {
+            unsigned long long k = 0;
+            size_t at = line.find("suppressed ");
+            if (suppressed != nullptr && at != std::string::npos && sscanf(line.c_str() + at, "suppressed %llu messages", &k) == 1) {
+                *suppressed += static_cast<long long> (k);
+            } else if (line.find(tag) != std::string::npos) {
+                ++ret;
+            }
+        }
+        return ret;
+    }
+
+    void sampled(int i) {
+        u_log_sample(info, 10, "sampled %d", i);
+    }
+
+    void limited(int i) {
+        u_log_rate(warning, 1, 3, "limited %d", i);
+    }
+
+    void hidden(int i) {
+        u_log_rate(debug, 1, 1, "hidden %d", i);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp";
+    std::string path = dir + "/u-log-limit.log";
+
+    /*one message in n*/
+    u::log_limit every;
+    int passed = 0;
+    for (int i = 0; i < 100; ++i) {
+        passed += every.sample(4) ? 1 : 0;
+    }
+    check("sample 1 in 4", passed, 25);
+    check("sample keeps no suppressed count", every.suppressed(), 0);
+
+    /*a burst, then one message per interval*/
+    u::log_limit bucket;
+    passed = 0;
+    for (int i = 0; i < 20; ++i) {
+        passed += bucket.rate(10, 5) ? 1 : 0;
+    }
+    check("burst", passed, 5);
+    check("suppressed", bucket.suppressed(), 15);
+    check("suppressed reset", bucket.suppressed(), 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(120));
+    check("refilled", bucket.rate(10, 5) ? 1 : 0, 1);
+
+    /*the macros, from several threads for sampling*/
+    u::log::open(u::F | 0x7F00, 0, ' ', path, std::ofstream::out | std::ofstream::trunc);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.push_back(std::thread([]() {
+            for (int i = 0; i < 1000; ++i) {
+                sampled(i);
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+    for (int i = 0; i < 1000; ++i) {
+        limited(i);
+        hidden(i);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    limited(1000);
+    u::log::open(u::T | 0x7F00);
+    long long suppressed = 0;
+    check("sampled lines", lines(path, "sampled "), 400);
+    check("limited lines", lines(path, "limited ", &suppressed), 4);
+    check("suppressed lines reported", suppressed, 997);
+    check("masked level logs nothing", lines(path, "hidden "), 0);
+    return failed;
+}
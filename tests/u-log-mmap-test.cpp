@@ -0,0 +1,103 @@
+/***
+  u-log-mmap-test.cpp checks that a mapped log file keeps its text over unclean exits
+  Copyright (C) 2013  Renweu Gao
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ***/
+
+/*
+ * build: g++ -std=c++11 -g -I.. u-log-mmap-test.cpp -o u-log-mmap-test -lpthread
+ * usage: u-log-mmap-test [directory for the logs] (exit status is the number of failed checks)
+ */
+
+#include "u-log"
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <sys/wait.h>
+
+namespace {
+
+    int failed = 0;
+
+    void check(const std::string &what, long long got, long long expected) {
+        if (got != expected) {
+            fprintf(stderr, "FAIL %s: got %lld, expected %lld\n", what.c_str(), got, expected);
+            ++failed;
+        }
+    }
+
+    std::string content(const std::string &path) {
+        std::ifstream in(path.c_str(), std::ios_base::binary);
+        return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    }
+
+    long long count(const std::string &text, const std::string &tag) {
+        long long ret = 0;
+        for (size_t at = text.find(tag); at != std::string::npos; at = text.find(tag, at + tag.size())) {
+            ++ret;
+        }
+        return ret;
+    }
+
+    /*log @lines lines tagged @tag into the mapped file @path from a child process killed without warning*/
+    void killed(const std::string &path, const std::string &tag, bool truncate, int lines) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            u::log::open(u::F | u::MMAP | 0x7F00, 0, ' ', path, std::ofstream::out | (truncate ? std::ofstream::trunc : std::ofstream::app));
+            for (int i = 0; i < lines; ++i) {
+                u::log::info("%s %d", tag.c_str(), i);
+            }
+            ::kill(::getpid(), SIGKILL);
+        }
+        int status = 0;
+        ::waitpid(pid, &status, 0);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp";
+    std::string path = dir + "/u-log-mmap.log";
+    const int lines = 100000;
+
+    /*each run appends right after the text of the killed one before it*/
+    killed(path, "first run", true, lines);
+    killed(path, "second run", false, lines);
+    u::log::open(u::F | u::MMAP | 0x7F00, 0, ' ', path, std::ofstream::out | std::ofstream::app);
+    u::log::info("clean run");
+    u::log::open(u::T | 0x7F00);
+    std::string text = content(path);
+    check("first run lines", count(text, "first run "), lines);
+    check("second run lines", count(text, "second run "), lines);
+    check("clean run lines", count(text, "clean run"), 1);
+    check("zero bytes", std::count(text.begin(), text.end(), '\0'), 0);
+    check("ends with a line", !text.empty() && text[text.size() - 1] == '\n' ? 1 : 0, 1);
+
+    /*zero bytes a file really ends with are not taken for preallocated space*/
+    std::string plain = dir + "/u-log-mmap-plain.log";
+    {
+        std::ofstream out(plain.c_str(), std::ios_base::binary | std::ios_base::trunc);
+        out.write("text\0\0\0", 7);
+    }
+    u::log::open(u::F | u::MMAP | 0x7F00, 0, ' ', plain, std::ofstream::out | std::ofstream::app);
+    u::log::info("appended");
+    u::log::open(u::T | 0x7F00);
+    text = content(plain);
+    check("zero bytes kept", std::string(text, 0, 7) == std::string("text\0\0\0", 7) ? 1 : 0, 1);
+    check("appended after them", count(text, "appended"), 1);
+    return failed;
+}
@@ -0,0 +1,106 @@
+/***
+  u-log-progress-test.cpp checks the counting and throttled repainting of u::progress
+  Copyright (C) 2013  Renweu Gao
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ***/
+
+/*
+ * build: g++ -std=c++11 -g -I.. u-log-progress-test.cpp -o u-log-progress-test -lpthread
+ * usage: u-log-progress-test (exit status is the number of failed checks)
+ */
+
+#include "u-log"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    int failed = 0;
+
+    void check(const std::string &what, long long got, long long expected) {
+        if (got != expected) {
+            fprintf(stderr, "FAIL %s: got %lld, expected %lld\n", what.c_str(), got, expected);
+            ++failed;
+        }
+    }
+
+    /*tick @total items from 4 threads over about @ms milliseconds, return what was painted*/
+    std::string drive(size_t total, size_t expected, int ms, size_t *counted) {
+        std::ostringstream screen;
+        std::streambuf *terminal = std::cout.rdbuf(screen.rdbuf());
+        {
+            u::progress bar(expected, "items", 20, 10);
+            std::vector<std::thread> threads;
+            for (int t = 0; t < 4; ++t) {
+                threads.push_back(std::thread([&bar, total, ms]() {
+                    for (size_t i = 0; i < total / 4; ++i) {
+                        ++bar;
+                        if (i % (total / 40) == 0) {
+                            std::this_thread::sleep_for(std::chrono::milliseconds(ms / 10));
+                        }
+                    }
+                }));
+            }
+            for (size_t t = 0; t < threads.size(); ++t) {
+                threads[t].join();
+            }
+            *counted = bar.done();
+        }
+        std::cout.rdbuf(terminal);
+        return screen.str();
+    }
+}
+
+int main() {
+    const size_t total = 100000;
+
+    /*known total: a bar repainted a few times, not once per item, ending complete*/
+    size_t counted = 0;
+    std::string screen = drive(total, total, 300, &counted);
+    check("counted", static_cast<long long> (counted), static_cast<long long> (total));
+    long long paints = std::count(screen.begin(), screen.end(), '\r');
+    check("repainted", paints >= 2 ? 1 : 0, 1);
+    check("throttled", paints <= 100 ? 1 : 0, 1);
+    std::string last = screen.substr(screen.rfind('\r'));
+    check("final bar", last.find("\ritems [==========] 100.0% 100000/100000 ") == 0 ? 1 : 0, 1);
+    check("throughput shown", last.find("/s ETA 00:00:00") != std::string::npos ? 1 : 0, 1);
+    check("ends the line", screen[screen.size() - 1] == '\n' ? 1 : 0, 1);
+
+    /*unknown total: a count instead of a bar*/
+    screen = drive(total, 0, 100, &counted);
+    last = screen.substr(screen.rfind('\r'));
+    check("final count", last.find("\ritems 100000 ") == 0 ? 1 : 0, 1);
+    check("no bar", last.find('[') == std::string::npos ? 1 : 0, 1);
+
+    /*finish paints once, the destructor does not paint again*/
+    std::ostringstream quiet;
+    std::streambuf *terminal = std::cout.rdbuf(quiet.rdbuf());
+    {
+        u::progress bar(10, "once", 1000);
+        bar += 10;
+        bar.finish();
+        bar.finish();
+    }
+    std::cout.rdbuf(terminal);
+    std::string text = quiet.str();
+    check("painted once", std::count(text.begin(), text.end(), '\r'), 1);
+    return failed;
+}
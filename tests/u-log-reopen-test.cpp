@@ -0,0 +1,144 @@
+/***
+  u-log-reopen-test.cpp checks that u::log::open releases the sinks of a previous open
+  Copyright (C) 2013  Renweu Gao
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ***/
+
+/*
+ * build: g++ -std=c++11 -g -fsanitize=thread -I.. u-log-reopen-test.cpp -o u-log-reopen-test -lpthread
+ * usage: u-log-reopen-test [directory for the logs] (exit status is the number of failed checks)
+ */
+
+#include "u-log"
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    int failed = 0;
+
+    void check(const std::string &what, size_t got, size_t expected) {
+        if (got != expected) {
+            fprintf(stderr, "FAIL %s: got %zu, expected %zu\n", what.c_str(), got, expected);
+            ++failed;
+        }
+    }
+
+    /*number of lines of @path holding @tag*/
+    size_t lines(const std::string &path, const std::string &tag) {
+        std::ifstream in(path.c_str());
+        std::string line;
+        size_t ret = 0;
+        while (std::getline(in, line)) {
+            if (line.find(tag) != std::string::npos) {
+                ++ret;
+            }
+        }
+        return ret;
+    }
+
+    /*log @count lines tagged @tag from each of @threads threads*/
+    void burst(const char *tag, int threads, int count) {
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.push_back(std::thread([tag, t, count]() {
+                for (int i = 0; i < count; ++i) {
+                    u::log::info("%s thread %d line %d", tag, t, i);
+                }
+            }));
+        }
+        for (size_t t = 0; t < workers.size(); ++t) {
+            workers[t].join();
+        }
+    }
+
+    /*first line of @path*/
+    std::string first(const std::string &path) {
+        std::ifstream in(path.c_str());
+        std::string line;
+        std::getline(in, line);
+        return line;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp";
+    std::string a = dir + "/u-log-reopen-a.log";
+    std::string b = dir + "/u-log-reopen-b.log";
+    std::string c = dir + "/u-log-reopen-c.log";
+    const std::ios_base::openmode trunc = std::ofstream::out | std::ofstream::trunc;
+    const int threads = 4;
+    const int count = 5000;
+
+    /*messages still queued for the async writer go to the file they were logged to*/
+    u::log::open(u::F | 0x7F00, 0, ' ', a, trunc);
+    u::log::async(1 << 12);
+    burst("first", threads, count);
+    u::log::open(u::F | 0x7F00, 0, ' ', b, trunc);
+    burst("second", threads, count);
+    u::log::rotate(1 << 30);
+    u::log::open(u::F | u::MMAP | 0x7F00, 0, ' ', c, trunc);
+    burst("third", threads, count);
+    u::log::open(u::F | 0x7F00, 0, ' ', a, std::ofstream::out | std::ofstream::app);
+    burst("fourth", threads, count);
+    u::log::sync();
+    u::log::open(u::T | 0x7F00);
+
+    check("first in a", lines(a, "first"), threads * count);
+    check("second in b", lines(b, "second"), threads * count);
+    check("third in c", lines(c, "third"), threads * count);
+    check("fourth in a", lines(a, "fourth"), threads * count);
+    check("second in a", lines(a, "second"), 0);
+    check("rotation of b stopped", std::ifstream((b + ".next").c_str()).good() ? 1 : 0, 0);
+    check("third in b", lines(b, "third"), 0);
+    std::ifstream mapped(c.c_str(), std::ios_base::ate | std::ios_base::binary);
+    std::ifstream::pos_type size = mapped.tellg();
+    std::string tail;
+    mapped.seekg(size - std::ifstream::pos_type(1));
+    std::getline(mapped, tail);
+    check("mapped file cut after its last line", tail.empty() ? 1 : 0, 1);
+
+    /*a thread which already indented starts again from the indent given to the next open*/
+    std::string d = dir + "/u-log-reopen-d.log";
+    u::log::open(u::F | 0x7F00, 2, '.', d, trunc);
+    std::mutex mutex;
+    std::condition_variable cv;
+    int step = 0;
+    std::thread indented([&]() {
+        u::log::indent(3, 0, "deeper");
+        std::unique_lock<std::mutex> lock(mutex);
+        step = 1;
+        cv.notify_all();
+        cv.wait(lock, [&step]() { return step == 2; });
+        lock.unlock();
+        u::log::indent(0, 0, "reopened");
+    });
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&step]() { return step == 1; });
+        u::log::open(u::F | 0x7F00, 1, '.', d, trunc);
+        step = 2;
+        cv.notify_all();
+    }
+    indented.join();
+    u::log::open(u::T | 0x7F00);
+    check("indent reloaded after open", first(d) == ".reopened" ? 1 : 0, 1);
+    return failed;
+}
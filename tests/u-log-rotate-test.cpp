@@ -0,0 +1,137 @@
+/***
+  u-log-rotate-test.cpp checks that rotated log files keep every line once
+  Copyright (C) 2013  Renweu Gao
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ***/
+
+/*
+ * build: g++ -std=c++11 -g -fsanitize=thread -I.. u-log-rotate-test.cpp -o u-log-rotate-test -lpthread
+ * usage: u-log-rotate-test [directory for the logs] (exit status is the number of failed checks)
+ */
+
+#include "u-log"
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    int failed = 0;
+
+    void check(const std::string &what, long long got, long long expected) {
+        if (got != expected) {
+            fprintf(stderr, "FAIL %s: got %lld, expected %lld\n", what.c_str(), got, expected);
+            ++failed;
+        }
+    }
+
+    bool exists(const std::string &path) {
+        return std::ifstream(path.c_str()).good();
+    }
+
+    /*count in @seen the lines "rotate thread <t> line <i>" of @path, return the number of other lines*/
+    long long scan(const std::string &path, std::vector<std::vector<int> > &seen) {
+        std::ifstream in(path.c_str());
+        std::string line;
+        long long other = 0;
+        while (std::getline(in, line)) {
+            int t = -1;
+            int i = -1;
+            size_t at = line.find("rotate thread ");
+            if (at == std::string::npos || sscanf(line.c_str() + at, "rotate thread %d line %d", &t, &i) != 2 ||
+                t < 0 || t >= static_cast<int> (seen.size()) || i < 0 || i >= static_cast<int> (seen[t].size())) {
+                ++other;
+                continue;
+            }
+            ++seen[t][i];
+        }
+        return other;
+    }
+
+    void burst(int threads, int count) {
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.push_back(std::thread([t, count]() {
+                for (int i = 0; i < count; ++i) {
+                    u::log::info("rotate thread %d line %d", t, i);
+                }
+            }));
+        }
+        for (size_t t = 0; t < workers.size(); ++t) {
+            workers[t].join();
+        }
+    }
+
+    /*log from @threads threads into @path rotated every @size bytes, @keep files kept*/
+    void run(const std::string &path, bool async, int threads, int count, size_t size, int keep) {
+        for (int i = 0; i <= keep + 1; ++i) {
+            ::unlink((i == 0 ? path : path + "." + std::to_string(i)).c_str());
+        }
+        u::log::open(u::F | 0x7F00, 0, ' ', path, std::ofstream::out | std::ofstream::trunc);
+        if (async) {
+            u::log::async(1 << 12);
+        }
+        u::log::rotate(size, 0, keep, 0);
+        burst(threads, count);
+        u::log::sync();
+        u::log::stop_rotate();
+        u::log::open(u::T | 0x7F00);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp";
+    std::string path = dir + "/u-log-rotate.log";
+    const int threads = 4;
+    const int count = 20000;
+
+    /*every line lands in exactly one file when enough files are kept*/
+    for (int async = 0; async < 2; ++async) {
+        std::string mode(async ? "async" : "sync");
+        const int keep = 1000;
+        run(path, async != 0, threads, count, 64 * 1024, keep);
+        std::vector<std::vector<int> > seen(threads, std::vector<int>(count, 0));
+        long long other = scan(path, seen);
+        int files = 0;
+        for (int i = 1; i <= keep && exists(path + "." + std::to_string(i)); ++i) {
+            other += scan(path + "." + std::to_string(i), seen);
+            ++files;
+        }
+        long long missing = 0;
+        long long twice = 0;
+        for (int t = 0; t < threads; ++t) {
+            for (int i = 0; i < count; ++i) {
+                missing += (seen[t][i] == 0) ? 1 : 0;
+                twice += (seen[t][i] > 1) ? 1 : 0;
+            }
+        }
+        check(mode + " lines missing", missing, 0);
+        check(mode + " lines twice", twice, 0);
+        check(mode + " broken lines", other, 0);
+        check(mode + " rotated at all", files > 1 ? 1 : 0, 1);
+        check(mode + " next file left", exists(path + ".next") ? 1 : 0, 0);
+    }
+
+    /*only @keep rotated files stay*/
+    const int keep = 3;
+    run(path, false, threads, count, 16 * 1024, keep);
+    for (int i = 1; i <= keep; ++i) {
+        check("kept file " + std::to_string(i), exists(path + "." + std::to_string(i)) ? 1 : 0, 1);
+    }
+    check("file beyond keep", exists(path + "." + std::to_string(keep + 1)) ? 1 : 0, 0);
+    return failed;
+}
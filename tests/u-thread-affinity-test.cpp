@@ -0,0 +1,128 @@
+/***
+  u-thread-affinity-test.cpp checks cpu discovery and the placement of work_station workers
+  Copyright (C) 2013  Renweu Gao
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ***/
+
+/*
+ * build: g++ -std=c++11 -g -O2 -I.. u-thread-affinity-test.cpp -o u-thread-affinity-test -lpthread
+ * usage: u-thread-affinity-test (exit status is the number of failed checks)
+ */
+
+#include "u-thread"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <sched.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+    int failed = 0;
+
+    void check(const std::string &what, long long got, long long expected) {
+        if (got != expected) {
+            fprintf(stderr, "FAIL %s: got %lld, expected %lld\n", what.c_str(), got, expected);
+            ++failed;
+        }
+    }
+
+    /*cpus the calling thread may run on*/
+    std::vector<int> allowed() {
+        std::vector<int> ret;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &set)) {
+                    ret.push_back(cpu);
+                }
+            }
+        }
+        return ret;
+    }
+}
+
+int main() {
+    /*sysfs cpu lists*/
+    std::vector<int> list = u::ws::topology::parse("0-3,8,10-11");
+    const int expected[] = {0, 1, 2, 3, 8, 10, 11};
+    check("parsed cpus", list == std::vector<int>(expected, expected + 7) ? 1 : 0, 1);
+    check("empty list", u::ws::topology::parse("").size(), 0);
+    check("single cpu", u::ws::topology::parse("5\n") == std::vector<int>(1, 5) ? 1 : 0, 1);
+
+    /*every cpu the process may use belongs to exactly one node*/
+    const std::vector<std::vector<int> > &nodes = u::ws::topology::nodes();
+    check("at least one node", nodes.empty() ? 0 : 1, 1);
+    std::vector<int> cpus = allowed();
+    long long homeless = 0;
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        int owners = 0;
+        for (size_t n = 0; n < nodes.size(); ++n) {
+            owners += std::count(nodes[n].begin(), nodes[n].end(), cpus[i]) > 0 ? 1 : 0;
+        }
+        homeless += (owners != 1) ? 1 : 0;
+        const std::vector<int> &node = nodes[u::ws::topology::node_of(cpus[i])];
+        check("node of cpu " + std::to_string(cpus[i]), std::count(node.begin(), node.end(), cpus[i]), 1);
+    }
+    check("cpus not in one node", homeless, 0);
+    check("node of an unknown cpu", u::ws::topology::node_of(-1), 0);
+    check("unpinned by default", u::ws::affinity().pinned() ? 1 : 0, 0);
+
+    /*workers pinned to a core only run there*/
+    if (!cpus.empty()) {
+        int cpu = cpus.back();
+        u::ws::work_station ws(2, u::ws::affinity::cores(std::vector<int>(1, cpu)));
+        std::atomic<int> elsewhere(0);
+        std::atomic<int> wide(0);
+        for (int i = 0; i < 100; ++i) {
+            ws.run([&elsewhere, &wide, cpu]() {
+                elsewhere.fetch_add(sched_getcpu() != cpu ? 1 : 0);
+                wide.fetch_add(allowed() != std::vector<int>(1, cpu) ? 1 : 0);
+            });
+        }
+        ws.wait();
+        check("tasks run off the pinned core", elsewhere.load(), 0);
+        check("workers allowed other cores", wide.load(), 0);
+        u::ws::station_stats stats = ws.stats();
+        for (size_t i = 0; i < stats._workers.size(); ++i) {
+            check("node of worker " + std::to_string(i), stats._workers[i]._node, u::ws::topology::node_of(cpu));
+        }
+    }
+
+    /*workers spread round-robin over the nodes, every node takes tasks queued for it*/
+    u::ws::affinity spread = u::ws::affinity::nodes();
+    check("spread is pinned", spread.pinned() ? 1 : 0, 1);
+    u::ws::work_station ws(static_cast<int> (nodes.size()) * 2, spread);
+    u::ws::station_stats stats = ws.stats();
+    for (size_t i = 0; i < stats._workers.size(); ++i) {
+        check("round robin node of worker " + std::to_string(i), stats._workers[i]._node, spread.node(static_cast<int> (i)));
+    }
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        if (nodes[n].empty()) {
+            continue;
+        }
+        std::atomic<int> ran(0);
+        for (int i = 0; i < 50; ++i) {
+            ws.run_on(static_cast<int> (n), [&ran]() {
+                ran.fetch_add(1);
+            });
+        }
+        ws.wait();
+        check("tasks of node " + std::to_string(n), ran.load(), 50);
+    }
+    return failed;
+}
@@ -0,0 +1,166 @@
+/***
+  u-thread-capacity-test.cpp checks the bounded submission of a work_station
+  Copyright (C) 2013  Renweu Gao
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ***/
+
+/*
+ * build: g++ -std=c++11 -g -O2 -I.. u-thread-capacity-test.cpp -o u-thread-capacity-test -lpthread
+ * usage: u-thread-capacity-test (exit status is the number of failed checks)
+ */
+
+#include "u-thread"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace {
+
+    int failed = 0;
+
+    void check(const std::string &what, long long got, long long expected) {
+        if (got != expected) {
+            fprintf(stderr, "FAIL %s: got %lld, expected %lld\n", what.c_str(), got, expected);
+            ++failed;
+        }
+    }
+
+    /*tasks blocked on a gate until it is opened*/
+    struct gate {
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        bool _open;
+        int _waiting;
+
+        gate() : _open(false), _waiting(0) {
+        }
+
+        void pass() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            ++_waiting;
+            _cv.notify_all();
+            _cv.wait(lock, [this]() { return _open; });
+        }
+
+        void wait_for(int waiting) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this, waiting]() { return _waiting >= waiting; });
+        }
+
+        void open() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _open = true;
+            _cv.notify_all();
+        }
+    };
+
+    long long since(const std::chrono::steady_clock::time_point &start) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+int main() {
+    const int workers = 2;
+    const int capacity = 4;
+    std::atomic<int> ran(0);
+    u::ws::work_station ws(workers);
+    ws.capacity(capacity);
+    check("capacity", static_cast<long long> (ws.capacity()), capacity);
+
+    /*with the workers held, only @capacity tasks can wait*/
+    gate held;
+    for (int i = 0; i < workers; ++i) {
+        ws.run([&held]() {
+            held.pass();
+        });
+    }
+    held.wait_for(workers);
+    int accepted = 0;
+    for (int i = 0; i < capacity * 2; ++i) {
+        accepted += ws.try_run([&ran]() {
+            ran.fetch_add(1);
+        }) ? 1 : 0;
+    }
+    check("accepted by try_run", accepted, capacity);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool queued = ws.run_for(std::chrono::milliseconds(30), [&ran]() {
+        ran.fetch_add(1);
+    });
+    check("run_for gave up", queued ? 0 : 1, 1);
+    check("run_for waited", since(start) >= 30 ? 1 : 0, 1);
+
+    /*run blocks until there is room*/
+    std::atomic<bool> returned(false);
+    std::thread producer([&ws, &ran, &returned]() {
+        ws.run([&ran]() {
+            ran.fetch_add(1);
+        });
+        returned.store(true);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    check("run blocked while full", returned.load() ? 1 : 0, 0);
+    start = std::chrono::steady_clock::now();
+    std::thread opener([&held]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        held.open();
+    });
+    queued = ws.run_for(std::chrono::seconds(10), [&ran]() {
+        ran.fetch_add(1);
+    });
+    check("run_for queued once there is room", queued ? 1 : 0, 1);
+    check("run_for returned early", since(start) < 5000 ? 1 : 0, 1);
+    opener.join();
+    producer.join();
+    ws.wait();
+    check("tasks run", ran.load(), capacity + 2);
+
+    /*a task submitting past the capacity runs queued tasks instead of blocking*/
+    std::atomic<int> children(0);
+    ws.capacity(1);
+    for (int i = 0; i < workers; ++i) {
+        ws.run([&ws, &children]() {
+            for (int j = 0; j < 100; ++j) {
+                ws.run([&children]() {
+                    children.fetch_add(1);
+                });
+            }
+        });
+    }
+    ws.wait();
+    check("tasks submitted by tasks", children.load(), workers * 100);
+
+    /*no bound*/
+    ws.capacity(0);
+    accepted = 0;
+    gate again;
+    for (int i = 0; i < workers; ++i) {
+        ws.run([&again]() {
+            again.pass();
+        });
+    }
+    again.wait_for(workers);
+    for (int i = 0; i < 1000; ++i) {
+        accepted += ws.try_run([]() {
+        }) ? 1 : 0;
+    }
+    again.open();
+    ws.wait();
+    check("accepted without a bound", accepted, 1000);
+    return failed;
+}
@@ -0,0 +1,137 @@
+/***
+  u-thread-graph-test.cpp checks that a task_graph runs every task after its dependencies
+  Copyright (C) 2013  Renweu Gao
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ***/
+
+/*
+ * build: g++ -std=c++11 -g -O2 -I.. u-thread-graph-test.cpp -o u-thread-graph-test -lpthread
+ * usage: u-thread-graph-test (exit status is the number of failed checks)
+ */
+
+#include "u-thread"
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+    int failed = 0;
+
+    void check(const std::string &what, long long got, long long expected) {
+        if (got != expected) {
+            fprintf(stderr, "FAIL %s: got %lld, expected %lld\n", what.c_str(), got, expected);
+            ++failed;
+        }
+    }
+
+    /*what the future of a run gives: 0 finished, 1 runtime_error, 2 logic_error, 3 other*/
+    int outcome(u::ws::future<void> f) {
+        try {
+            f.get();
+        } catch (const std::logic_error &) {
+            return 2;
+        } catch (const std::runtime_error &) {
+            return 1;
+        } catch (...) {
+            return 3;
+        }
+        return 0;
+    }
+}
+
+int main() {
+    u::ws::work_station ws(4);
+
+    /*a random graph whose edges go from lower to higher ids, run twice*/
+    const size_t tasks = 300;
+    std::atomic<long> clock(0);
+    std::vector<std::atomic<long> > at(tasks);
+    std::vector<std::vector<size_t> > deps(tasks);
+    u::ws::task_graph graph;
+    unsigned seed = 12345;
+    for (size_t i = 0; i < tasks; ++i) {
+        for (size_t j = 0; j < i && deps[i].size() < 4; ++j) {
+            seed = seed * 1103515245u + 12345u;
+            if ((seed >> 16) % 16 == 0) {
+                deps[i].push_back(j);
+            }
+        }
+        graph.add([&clock, &at, i]() {
+            at[i].store(clock.fetch_add(1));
+        }, deps[i]);
+    }
+    check("size", graph.size(), tasks);
+    for (int round = 0; round < 2; ++round) {
+        std::string what = "round " + std::to_string(round);
+        for (size_t i = 0; i < tasks; ++i) {
+            at[i].store(-1);
+        }
+        check(what + " finished", outcome(graph.run(ws)), 0);
+        long long early = 0;
+        long long skipped = 0;
+        for (size_t i = 0; i < tasks; ++i) {
+            skipped += (at[i].load() < 0) ? 1 : 0;
+            for (size_t d = 0; d < deps[i].size(); ++d) {
+                early += (at[i].load() <= at[deps[i][d]].load()) ? 1 : 0;
+            }
+        }
+        check(what + " tasks not run", skipped, 0);
+        check(what + " tasks run before a dependency", early, 0);
+    }
+
+    /*a failing task skips what depends on it and fails the run*/
+    {
+        std::atomic<int> after(0);
+        u::ws::task_graph failing;
+        size_t a = failing.add([]() {
+            throw std::runtime_error("task");
+        });
+        size_t b = failing.add([&after]() {
+            after.fetch_add(1);
+        }, std::vector<size_t>(1, a));
+        failing.add([&after]() {
+            after.fetch_add(1);
+        }, std::vector<size_t>(1, b));
+        check("failure reported", outcome(failing.run(ws)), 1);
+        check("successors skipped", after.load(), 0);
+    }
+
+    /*a cycle runs nothing and is reported, whether assertions are compiled in or not*/
+    {
+        std::atomic<int> ran(0);
+        u::ws::task_graph cyclic;
+        size_t a = cyclic.add([&ran]() {
+            ran.fetch_add(1);
+        });
+        size_t b = cyclic.add([&ran]() {
+            ran.fetch_add(1);
+        }, std::vector<size_t>(1, a));
+        size_t c = cyclic.add([&ran]() {
+            ran.fetch_add(1);
+        }, std::vector<size_t>(1, b));
+        cyclic.precede(c, a);
+        check("cycle reported", outcome(cyclic.run(ws)), 2);
+        check("cycle reported again", outcome(cyclic.run(ws)), 2);
+        check("nothing of the cycle ran", ran.load(), 0);
+    }
+
+    /*an empty graph is finished at once*/
+    u::ws::task_graph empty;
+    check("empty graph", outcome(empty.run(ws)), 0);
+    return failed;
+}
@@ -0,0 +1,130 @@
+/***
+  u-thread-parallel-test.cpp checks the range algorithms running on a work_station
+  Copyright (C) 2013  Renweu Gao
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ***/
+
+/*
+ * build: g++ -std=c++11 -g -O2 -I.. u-thread-parallel-test.cpp -o u-thread-parallel-test -lpthread
+ * usage: u-thread-parallel-test (exit status is the number of failed checks)
+ */
+
+#include "u-thread"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+    int failed = 0;
+
+    void check(const std::string &what, long long got, long long expected) {
+        if (got != expected) {
+            fprintf(stderr, "FAIL %s: got %lld, expected %lld\n", what.c_str(), got, expected);
+            ++failed;
+        }
+    }
+}
+
+int main() {
+    u::ws::work_station ws(4);
+    const size_t sizes[] = {0, 1, 7, 1000, 100003};
+    const size_t grains[] = {0, 1, 3, 1 << 20};
+
+    /*every index is visited once, whatever the size and the grain*/
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        for (size_t g = 0; g < sizeof(grains) / sizeof(grains[0]); ++g) {
+            std::string what = "size " + std::to_string(sizes[s]) + " grain " + std::to_string(grains[g]);
+            std::vector<std::atomic<int> > seen(sizes[s] + 10);
+            for (size_t i = 0; i < seen.size(); ++i) {
+                seen[i].store(0);
+            }
+            u::ws::parallel_for(ws, 10, 10 + sizes[s], [&seen](size_t i) {
+                seen[i].fetch_add(1);
+            }, grains[g]);
+            long long wrong = 0;
+            for (size_t i = 0; i < seen.size(); ++i) {
+                wrong += (seen[i].load() != (i < 10 ? 0 : 1)) ? 1 : 0;
+            }
+            check(what + " for visits", wrong, 0);
+
+            std::vector<long long> in(sizes[s]);
+            for (size_t i = 0; i < in.size(); ++i) {
+                in[i] = static_cast<long long> ((i * 7919) % 1009);
+            }
+            std::vector<long long> out(in.size(), -1);
+            std::vector<long long>::iterator end = u::ws::parallel_transform(ws, in.begin(), in.end(), out.begin(), [](long long v) {
+                return v * 2;
+            }, grains[g]);
+            wrong = (end == out.end()) ? 0 : 1;
+            for (size_t i = 0; i < in.size(); ++i) {
+                wrong += (out[i] != in[i] * 2) ? 1 : 0;
+            }
+            check(what + " transform", wrong, 0);
+
+            long long sum = 0;
+            for (size_t i = 0; i < in.size(); ++i) {
+                sum += in[i];
+            }
+            check(what + " reduce", u::ws::parallel_reduce(ws, in.begin(), in.end(), 5LL, std::plus<long long>(), grains[g]), sum + 5);
+
+            std::vector<long long> sorted(in);
+            std::sort(sorted.begin(), sorted.end());
+            u::ws::parallel_sort(ws, in.begin(), in.end(), std::less<long long>(), grains[g]);
+            check(what + " sort", in == sorted ? 1 : 0, 1);
+        }
+    }
+
+    /*chunks are combined in order, so a non commutative operation works*/
+    std::vector<std::string> letters;
+    std::string expected;
+    for (int i = 0; i < 2000; ++i) {
+        letters.push_back(std::string(1, static_cast<char> ('a' + i % 26)));
+        expected += letters.back();
+    }
+    std::string joined = u::ws::parallel_reduce(ws, letters.begin(), letters.end(), std::string(">"), [](const std::string &a, const std::string &b) {
+        return a + b;
+    }, 7);
+    check("reduce keeps the order", joined == ">" + expected ? 1 : 0, 1);
+
+    /*an exception thrown by a chunk reaches the caller once every chunk is done*/
+    std::atomic<int> visited(0);
+    bool thrown = false;
+    try {
+        u::ws::parallel_for(ws, 0, 1000, [&visited](size_t i) {
+            visited.fetch_add(1);
+            if (i == 500) {
+                throw std::runtime_error("chunk");
+            }
+        }, 10);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    check("exception rethrown", thrown ? 1 : 0, 1);
+    check("other chunks finished", visited.load() >= 991 ? 1 : 0, 1);
+
+    /*a parallel loop inside a task runs on the same workers without deadlocking*/
+    std::atomic<long> inner(0);
+    u::ws::parallel_for(ws, 0, 16, [&ws, &inner](size_t) {
+        u::ws::parallel_for(ws, 0, 100, [&inner](size_t) {
+            inner.fetch_add(1);
+        }, 1);
+    }, 1);
+    check("nested loops", inner.load(), 1600);
+    return failed;
+}
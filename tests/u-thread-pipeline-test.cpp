@@ -0,0 +1,194 @@
+/***
+  u-thread-pipeline-test.cpp checks order, filtering, bounds and errors of u::ws::pipeline
+  Copyright (C) 2013  Renweu Gao
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ***/
+
+/*
+ * build: g++ -std=c++11 -g -O2 -I.. u-thread-pipeline-test.cpp -o u-thread-pipeline-test -lpthread
+ * usage: u-thread-pipeline-test (exit status is the number of failed checks)
+ */
+
+#include "u-thread"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    int failed = 0;
+
+    void check(const std::string &what, long long got, long long expected) {
+        if (got != expected) {
+            fprintf(stderr, "FAIL %s: got %lld, expected %lld\n", what.c_str(), got, expected);
+            ++failed;
+        }
+    }
+
+    /*source of the integers [0, @count)*/
+    struct counter {
+        int _next;
+        int _count;
+
+        counter(int count) : _next(0), _count(count) {
+        }
+
+        bool operator()(int &value) {
+            if (_next == _count) {
+                return false;
+            }
+            value = _next++;
+            return true;
+        }
+    };
+
+    void jitter(int value) {
+        if (value % 7 == 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+}
+
+int main() {
+    u::ws::work_station ws(4);
+    const int count = 2000;
+
+    /*an ordered sink sees the source order whatever the parallel stages do*/
+    {
+        std::vector<std::string> out;
+        u::ws::pipeline<int>(ws, counter(count))
+            .then([](int &v) {
+                jitter(v);
+                return v * 3;
+            }, 4)
+            .filter([](int &v) {
+                return v % 2 == 0;
+            }, 2)
+            .then([](int &v) {
+                return std::to_string(v);
+            }, 4)
+            .sink([&out](std::string &s) {
+                out.push_back(s);
+            });
+        long long wrong = (out.size() == count / 2) ? 0 : 1;
+        for (size_t i = 0; i < out.size() && wrong == 0; ++i) {
+            wrong += (out[i] != std::to_string(static_cast<int> (i) * 6)) ? 1 : 0;
+        }
+        check("ordered output", wrong, 0);
+    }
+
+    /*an ordered stage in the middle handles one item at a time, in order*/
+    {
+        std::atomic<int> inside(0);
+        std::atomic<int> overlap(0);
+        int expected = 0;
+        int misordered = 0;
+        std::atomic<long long> sum(0);
+        u::ws::pipeline<int>(ws, counter(count))
+            .then([](int &v) {
+                jitter(v);
+                return v;
+            }, 4)
+            .then([&](int &v) {
+                overlap.fetch_add(inside.fetch_add(1) != 0 ? 1 : 0);
+                misordered += (v != expected++) ? 1 : 0;
+                inside.fetch_sub(1);
+                return v;
+            }, 4, true)
+            .sink([&sum](int &v) {
+                sum.fetch_add(v);
+            }, false, 4);
+        check("ordered stage overlapped", overlap.load(), 0);
+        check("ordered stage misordered", misordered, 0);
+        check("unordered sink sum", sum.load(), static_cast<long long> (count) * (count - 1) / 2);
+    }
+
+    /*no more than @tokens items are in flight*/
+    {
+        const size_t tokens = 5;
+        std::atomic<int> flight(0);
+        std::atomic<int> most(0);
+        u::ws::pipeline<int>(ws, counter(count), tokens)
+            .then([&flight, &most](int &v) {
+                int now = flight.fetch_add(1) + 1;
+                int seen = most.load();
+                while (now > seen && !most.compare_exchange_weak(seen, now)) {
+                }
+                jitter(v);
+                return v;
+            }, 4)
+            .sink([&flight](int &) {
+                flight.fetch_sub(1);
+            }, false, 4);
+        check("items in flight over the tokens", most.load() <= static_cast<int> (tokens) ? 1 : 0, 1);
+    }
+
+    /*the first exception stops the source and reaches the caller*/
+    {
+        int produced = 0;
+        bool thrown = false;
+        try {
+            u::ws::pipeline<int>(ws, [&produced](int &v) {
+                v = produced++;
+                return true; // endless, only the failure stops it
+            }, 8)
+                .then([](int &v) {
+                    if (v == 100) {
+                        throw std::runtime_error("stage");
+                    }
+                    return v;
+                }, 2)
+                .sink([](int &) {
+                });
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        check("exception rethrown", thrown ? 1 : 0, 1);
+        check("source stopped", produced < 200 ? 1 : 0, 1);
+    }
+
+    /*many short pipelines, none left hanging by a lost wake-up*/
+    long long total = 0;
+    for (int run = 0; run < 500; ++run) {
+        int got = 0;
+        u::ws::pipeline<int>(ws, counter(run % 10), 2)
+            .then([](int &v) {
+                return v + 1;
+            }, 2)
+            .sink([&got](int &) {
+                ++got;
+            });
+        total += got;
+    }
+    check("short pipelines", total, 50 * 45);
+
+    /*a pipeline run from inside a task*/
+    std::atomic<int> nested(0);
+    ws.submit([&ws, &nested]() {
+        u::ws::pipeline<int>(ws, counter(100))
+            .then([](int &v) {
+                return v;
+            }, 2)
+            .sink([&nested](int &) {
+                nested.fetch_add(1);
+            });
+    }).get();
+    check("pipeline inside a task", nested.load(), 100);
+    return failed;
+}
@@ -0,0 +1,167 @@
+/***
+  u-thread-steal-test.cpp checks the work stealing deque and the tasks a station spreads with it
+  Copyright (C) 2013  Renweu Gao
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ***/
+
+/*
+ * build: g++ -std=c++11 -g -O2 -I.. u-thread-steal-test.cpp -o u-thread-steal-test -lpthread
+ * usage: u-thread-steal-test (exit status is the number of failed checks)
+ */
+
+#include "u-thread"
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    int failed = 0;
+
+    void check(const std::string &what, long long got, long long expected) {
+        if (got != expected) {
+            fprintf(stderr, "FAIL %s: got %lld, expected %lld\n", what.c_str(), got, expected);
+            ++failed;
+        }
+    }
+
+    long long value(int *item) {
+        return item == nullptr ? -1 : *item;
+    }
+
+    /*a task splitting itself in two until @depth reaches 0, counting the leaves*/
+    void split(u::ws::work_station &ws, int depth, std::atomic<long> &leaves, std::atomic<long> &remote) {
+        if (depth == 0) {
+            leaves.fetch_add(1);
+            return;
+        }
+        for (int i = 0; i < 2; ++i) {
+            if (ws.run(split, std::ref(ws), depth - 1, std::ref(leaves), std::ref(remote)) < 0) {
+                remote.fetch_add(1);
+            }
+        }
+    }
+}
+
+int main() {
+    std::vector<int> items(1000);
+    for (size_t i = 0; i < items.size(); ++i) {
+        items[i] = static_cast<int> (i);
+    }
+
+    /*the owner takes the newest item, thieves the oldest*/
+    {
+        u::ws::steal_deque<int> deque(4);
+        for (int i = 0; i < 3; ++i) {
+            deque.push(&items[i]);
+        }
+        bool retry = false;
+        check("take newest", value(deque.take()), 2);
+        check("steal oldest", value(deque.steal(retry)), 0);
+        check("steal not contended", retry ? 1 : 0, 0);
+        check("take last", value(deque.take()), 1);
+        check("take empty", value(deque.take()), -1);
+        check("steal empty", value(deque.steal(retry)), -1);
+    }
+
+    /*the ring grows without losing or reordering items*/
+    {
+        u::ws::steal_deque<int> deque(4);
+        for (size_t i = 0; i < items.size(); ++i) {
+            deque.push(&items[i]);
+        }
+        check("size after growth", deque.size(), static_cast<long long> (items.size()));
+        bool retry = false;
+        long long order = 0;
+        for (size_t i = 0; i < items.size() / 2; ++i) {
+            order += (value(deque.steal(retry)) == static_cast<long long> (i)) ? 1 : 0;
+        }
+        for (size_t i = items.size(); i > items.size() / 2; --i) {
+            order += (value(deque.take()) == static_cast<long long> (i - 1)) ? 1 : 0;
+        }
+        check("order after growth", order, static_cast<long long> (items.size()));
+    }
+
+    /*every item goes to exactly one of the owner and the thieves*/
+    {
+        const int rounds = 200;
+        const int thieves = 3;
+        u::ws::steal_deque<int> deque(8);
+        std::vector<std::atomic<int> > seen(items.size());
+        for (size_t i = 0; i < seen.size(); ++i) {
+            seen[i].store(0);
+        }
+        std::atomic<bool> done(false);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < thieves; ++t) {
+            threads.push_back(std::thread([&]() {
+                bool retry = false;
+                while (!done.load()) {
+                    int *item = deque.steal(retry);
+                    if (item != nullptr) {
+                        seen[*item].fetch_add(1);
+                    }
+                }
+            }));
+        }
+        for (int r = 0; r < rounds; ++r) {
+            for (size_t i = 0; i < items.size(); ++i) {
+                deque.push(&items[i]);
+                if (i % 3 == 0) {
+                    int *item = deque.take();
+                    if (item != nullptr) {
+                        seen[*item].fetch_add(1);
+                    }
+                }
+            }
+            while (int *item = deque.take()) {
+                seen[*item].fetch_add(1);
+            }
+            while (deque.size() > 0) {
+                std::this_thread::yield();
+            }
+        }
+        done.store(true);
+        for (size_t t = 0; t < threads.size(); ++t) {
+            threads[t].join();
+        }
+        long long wrong = 0;
+        for (size_t i = 0; i < seen.size(); ++i) {
+            wrong += (seen[i].load() != rounds) ? 1 : 0;
+        }
+        check("items not seen once per round", wrong, 0);
+    }
+
+    /*tasks submitted by tasks stay on the deque of their worker and all run*/
+    {
+        const int depth = 12;
+        u::ws::work_station ws(4);
+        std::atomic<long> leaves(0);
+        std::atomic<long> remote(0);
+        check("submitted from outside", ws.run(split, std::ref(ws), depth, std::ref(leaves), std::ref(remote)), -1);
+        ws.wait();
+        check("leaves", leaves.load(), 1L << depth);
+        check("submitted from a task to another queue", remote.load(), 0);
+        long long executed = 0;
+        u::ws::station_stats stats = ws.stats();
+        for (size_t i = 0; i < stats._workers.size(); ++i) {
+            executed += stats._workers[i]._executed;
+        }
+        check("tasks executed", executed, (1LL << (depth + 1)) - 1);
+    }
+    return failed;
+}
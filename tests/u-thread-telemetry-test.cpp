@@ -0,0 +1,166 @@
+/***
+  u-thread-telemetry-test.cpp checks the counters, gauges and latencies of a work_station
+  Copyright (C) 2013  Renweu Gao
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ***/
+
+/*
+ * build: g++ -std=c++11 -g -O2 -I.. u-thread-telemetry-test.cpp -o u-thread-telemetry-test -lpthread
+ * usage: u-thread-telemetry-test (exit status is the number of failed checks)
+ */
+
+#include "u-thread"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace {
+
+    int failed = 0;
+
+    void check(const std::string &what, long long got, long long expected) {
+        if (got != expected) {
+            fprintf(stderr, "FAIL %s: got %lld, expected %lld\n", what.c_str(), got, expected);
+            ++failed;
+        }
+    }
+
+    /*tasks blocked on a gate until it is opened*/
+    struct gate {
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        bool _open;
+        int _waiting;
+
+        gate() : _open(false), _waiting(0) {
+        }
+
+        void pass() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            ++_waiting;
+            _cv.notify_all();
+            _cv.wait(lock, [this]() { return _open; });
+        }
+
+        void wait_for(int waiting) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this, waiting]() { return _waiting >= waiting; });
+        }
+
+        void open() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _open = true;
+            _cv.notify_all();
+        }
+    };
+
+    unsigned long long executed(const u::ws::station_stats &stats) {
+        unsigned long long ret = 0;
+        for (size_t i = 0; i < stats._workers.size(); ++i) {
+            ret += stats._workers[i]._executed;
+        }
+        return ret;
+    }
+}
+
+int main() {
+    /*buckets are powers of two of nanoseconds*/
+    check("bucket of 0", u::ws::histogram::bucket(0), 0);
+    check("bucket of 1", u::ws::histogram::bucket(1), 1);
+    check("bucket of 3", u::ws::histogram::bucket(3), 2);
+    check("bucket of 1024", u::ws::histogram::bucket(1024), 11);
+    u::ws::histogram h;
+    for (int i = 0; i < 90; ++i) {
+        h.record(100);
+    }
+    for (int i = 0; i < 10; ++i) {
+        h.record(100000);
+    }
+    u::ws::histogram::latency l = h.snapshot();
+    check("histogram count", l._count, 100);
+    check("histogram mean", static_cast<long long> (l.mean()), (90 * 100 + 10 * 100000) / 100);
+    check("histogram p50", l.percentile(50), 128);
+    check("histogram p99", l.percentile(99), 131072);
+
+    /*gauges while the workers are held*/
+    const int workers = 2;
+    const int queued = 10;
+    u::ws::work_station ws(workers);
+    ws.telemetry(true);
+    gate held;
+    for (int i = 0; i < workers; ++i) {
+        ws.run([&held]() {
+            held.pass();
+        });
+    }
+    held.wait_for(workers);
+    for (int i = 0; i < queued; ++i) {
+        ws.run([]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        });
+    }
+    u::ws::station_stats stats = ws.stats();
+    check("pending", stats._pending, queued);
+    check("busy", stats._busy, workers + queued);
+    check("inbox", static_cast<long long> (stats._inbox), queued);
+    check("workers", static_cast<long long> (stats._workers.size()), workers);
+    held.open();
+    ws.wait();
+
+    /*counters and latencies once everything ran*/
+    stats = ws.stats();
+    check("executed", executed(stats), workers + queued);
+    check("pending after", stats._pending, 0);
+    check("busy after", stats._busy, 0);
+    check("run latencies", stats._run._count, workers + queued);
+    check("wait latencies", stats._wait._count, workers + queued);
+    check("run at least 2ms", stats._run.percentile(50) >= 2000000ULL ? 1 : 0, 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ws.run([]() {
+    });
+    ws.wait();
+    stats = ws.stats();
+    double idle = 0;
+    for (size_t i = 0; i < stats._workers.size(); ++i) {
+        idle += stats._workers[i]._idle;
+    }
+    check("idle time recorded", idle >= 0.04 ? 1 : 0, 1);
+
+    /*without timing only the counts move*/
+    ws.telemetry(false);
+    for (int i = 0; i < queued; ++i) {
+        ws.run([]() {
+        });
+    }
+    ws.wait();
+    stats = ws.stats();
+    check("executed without timing", executed(stats), workers + queued + 1 + queued);
+    check("run latencies without timing", stats._run._count, workers + queued + 1);
+
+    /*periodic dump*/
+    std::ostringstream os;
+    ws.dump_every(std::chrono::milliseconds(10), os);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ws.dump_every(std::chrono::milliseconds(0), os);
+    std::string text = os.str();
+    check("dumped", text.find("[work_station] pending 0, busy 0") != std::string::npos ? 1 : 0, 1);
+    check("dumped workers", text.find("worker   1 node 0: executed") != std::string::npos ? 1 : 0, 1);
+    return failed;
+}
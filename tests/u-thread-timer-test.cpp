@@ -0,0 +1,166 @@
+/***
+  u-thread-timer-test.cpp checks deadlines, periods and cancellation of u::ws::timer_wheel
+  Copyright (C) 2013  Renweu Gao
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ***/
+
+/*
+ * build: g++ -std=c++11 -g -O2 -I.. u-thread-timer-test.cpp -o u-thread-timer-test -lpthread
+ * usage: u-thread-timer-test (exit status is the number of failed checks)
+ */
+
+#include "u-thread"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    int failed = 0;
+
+    void check(const std::string &what, long long got, long long expected) {
+        if (got != expected) {
+            fprintf(stderr, "FAIL %s: got %lld, expected %lld\n", what.c_str(), got, expected);
+            ++failed;
+        }
+    }
+
+    typedef std::chrono::steady_clock clock_type;
+
+    long long ms(const clock_type::duration &d) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+    }
+
+    /*when each timer of a test fired, in firing order*/
+    struct firings {
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        std::vector<std::pair<int, clock_type::time_point> > _at;
+
+        void fire(int id) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _at.push_back(std::make_pair(id, clock_type::now()));
+            _cv.notify_all();
+        }
+
+        bool wait_for(size_t count, const clock_type::duration &timeout) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _cv.wait_for(lock, timeout, [this, count]() { return _at.size() >= count; });
+        }
+    };
+}
+
+int main() {
+    u::ws::work_station ws(2);
+    u::ws::timer_wheel wheel(ws);
+    /*generous, the machine running the test may be loaded*/
+    const long long late = 250;
+
+    /*one shot timers fire at their deadline, not before, in deadline order. 300ms and
+      70s go beyond the first level of the wheel and are cascaded down*/
+    {
+        firings f;
+        clock_type::time_point start = clock_type::now();
+        const int delays[] = {50, 10, 300, 30};
+        for (int i = 0; i < 4; ++i) {
+            wheel.run_after(std::chrono::milliseconds(delays[i]), &firings::fire, &f, delays[i]);
+        }
+        u::ws::timer_wheel::handle far = wheel.run_after(std::chrono::seconds(70), &firings::fire, &f, -1);
+        check("pending timers", static_cast<long long> (wheel.size()), 5);
+        check("all fired", f.wait_for(4, std::chrono::seconds(5)) ? 1 : 0, 1);
+        const int order[] = {10, 30, 50, 300};
+        for (size_t i = 0; i < f._at.size() && i < 4; ++i) {
+            std::string what = "timer " + std::to_string(order[i]) + "ms";
+            check(what + " order", f._at[i].first, order[i]);
+            long long at = ms(f._at[i].second - start);
+            check(what + " early", at < order[i] ? 1 : 0, 0);
+            check(what + " late", at > order[i] + late ? 1 : 0, 0);
+        }
+        check("far timer pending", static_cast<long long> (wheel.size()), 1);
+        check("far timer cancelled", wheel.cancel(far) ? 1 : 0, 1);
+        check("far timer cancelled twice", wheel.cancel(far) ? 1 : 0, 0);
+    }
+
+    /*a cancelled timer never fires, an expired one cannot be cancelled*/
+    {
+        firings f;
+        u::ws::timer_wheel::handle gone = wheel.run_after(std::chrono::milliseconds(20), &firings::fire, &f, 1);
+        u::ws::timer_wheel::handle kept = wheel.run_after(std::chrono::milliseconds(40), &firings::fire, &f, 2);
+        check("cancel pending", wheel.cancel(gone) ? 1 : 0, 1);
+        check("kept fired", f.wait_for(1, std::chrono::seconds(5)) ? 1 : 0, 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        check("fired once", static_cast<long long> (f._at.size()), 1);
+        check("the kept one", f._at.empty() ? -1 : f._at[0].first, 2);
+        check("cancel expired", wheel.cancel(kept) ? 1 : 0, 0);
+        check("no timer left", static_cast<long long> (wheel.size()), 0);
+    }
+
+    /*a periodic timer keeps its period until cancelled*/
+    {
+        firings f;
+        clock_type::time_point start = clock_type::now();
+        u::ws::timer_wheel::handle every = wheel.run_every(std::chrono::milliseconds(20), &firings::fire, &f, 0);
+        check("ten periods", f.wait_for(10, std::chrono::seconds(5)) ? 1 : 0, 1);
+        check("cancel periodic", wheel.cancel(every) ? 1 : 0, 1);
+        ws.wait();
+        size_t fired = f._at.size();
+        check("periods early", ms(f._at[9].second - start) < 200 ? 1 : 0, 0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        check("periodic stopped", static_cast<long long> (f._at.size()), static_cast<long long> (fired));
+    }
+
+    /*expired timers reach a station at its capacity without waiting for room*/
+    {
+        u::ws::work_station one(1);
+        u::ws::timer_wheel full(one);
+        one.capacity(1);
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool go = false;
+        std::atomic<bool> started(false);
+        one.run([&]() {
+            started.store(true);
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&go]() { return go; });
+        });
+        while (!started.load()) {
+            std::this_thread::yield();
+        }
+        one.run([]() {
+        });
+        std::atomic<int> fired(0);
+        for (int i = 1; i <= 5; ++i) {
+            full.run_after(std::chrono::milliseconds(10 * i), [&fired]() {
+                fired.fetch_add(1);
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100 + late));
+        check("queued past the capacity", one.stats()._pending, 6);
+        check("timers left in the wheel", static_cast<long long> (full.size()), 0);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            go = true;
+        }
+        cv.notify_all();
+        one.wait();
+        check("fired once room was made", fired.load(), 5);
+    }
+    return failed;
+}
@@ -0,0 +1,47 @@
+/***
+  u-log-decode.cpp print binary logs written through u_log_binary as text
+  Copyright (C) 2013  Renweu Gao
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ***/
+
+/*
+ * build: g++ -std=c++11 -I.. u-log-decode.cpp -o u-log-decode -lpthread
+ * usage: u-log-decode <binary log>... (standard input when no file is given)
+ */
+
+#include "u-log"
+#include <iostream>
+#include <fstream>
+
+int main(int argc, char *argv[]) {
+    int ret = 0;
+    if (argc == 1) {
+        if (!u::log_binary::decode(std::cin, std::cout)) {
+            std::cerr << "<stdin>: not a binary log, truncated or corrupt" << std::endl;
+            ret = 1;
+        }
+    }
+    for (int i = 1; i < argc; ++i) {
+        std::ifstream in(argv[i], std::ios_base::in | std::ios_base::binary);
+        if (!in.is_open()) {
+            std::cerr << argv[i] << ": cannot open" << std::endl;
+            ret = 1;
+        } else if (!u::log_binary::decode(in, std::cout)) {
+            std::cerr << argv[i] << ": not a binary log, truncated or corrupt" << std::endl;
+            ret = 1;
+        }
+    }
+    return ret;
+}